@@ -1,14 +1,56 @@
 PHP_ARG_ENABLE(fiber, whether to enable fiber support,
 [  --enable-fiber          Enable fiber fiber support], no)
 
+PHP_ARG_ENABLE(fiber-dtrace, whether to enable fiber static probes,
+[  --enable-fiber-dtrace   Add SDT probes for fiber lifecycle and switches], no, no)
+
+PHP_ARG_WITH(fiber-io-uring, whether to use io_uring for fiber I/O,
+[  --with-fiber-io-uring   Use liburing for completion based fiber I/O], no, no)
+
 if test "$PHP_FIBER" != "no"; then
   AC_DEFINE(HAVE_FIBER, 1, [ ])
   
   FIBER_CFLAGS="-Wall -DZEND_ENABLE_STATIC_TSRMLS_CACHE=1"
 
+  AC_CHECK_HEADERS([sys/epoll.h sys/eventfd.h])
+
+  AC_CHECK_HEADER([pthread.h], [
+    PHP_CHECK_LIBRARY(pthread, pthread_create, [
+      PHP_ADD_LIBRARY(pthread, 1, FIBER_SHARED_LIBADD)
+    ])
+    AC_DEFINE(HAVE_FIBER_THREAD_POOL, 1, [Whether blocking calls can be offloaded to worker threads])
+  ])
+
+  if test "$PHP_FIBER_IO_URING" != "no"; then
+    PHP_CHECK_LIBRARY(uring, io_uring_queue_init, [
+      PHP_ADD_LIBRARY(uring, 1, FIBER_SHARED_LIBADD)
+      AC_DEFINE(HAVE_FIBER_IO_URING, 1, [Whether liburing is available])
+    ], [
+      AC_MSG_ERROR([liburing not found])
+    ])
+  fi
+
+  if test "$PHP_FIBER_DTRACE" != "no"; then
+    AC_CHECK_HEADER([sys/sdt.h], [
+      AC_DEFINE(HAVE_FIBER_DTRACE, 1, [Whether fiber SDT probes are enabled])
+    ], [
+      AC_MSG_ERROR([sys/sdt.h not found, install systemtap-sdt-dev])
+    ])
+  fi
+
   fiber_source_files="src/php_fiber.c \
     src/fiber.c \
-    src/fiber_stack.c"
+    src/fiber_cancellation.c \
+    src/fiber_channel.c \
+    src/fiber_hook.c \
+    src/fiber_io.c \
+    src/fiber_local.c \
+    src/fiber_reactor.c \
+    src/fiber_scheduler.c \
+    src/fiber_stack.c \
+    src/fiber_sync.c \
+    src/fiber_thread.c \
+    src/fiber_timer.c"
   
   fiber_use_asm="yes"
   
@@ -64,6 +106,7 @@ if test "$PHP_FIBER" != "no"; then
   
   PHP_NEW_EXTENSION(fiber, $fiber_source_files, $ext_shared,, \\$(FIBER_CFLAGS))
   PHP_SUBST(FIBER_CFLAGS)
+  PHP_SUBST(FIBER_SHARED_LIBADD)
   PHP_ADD_MAKEFILE_FRAGMENT
   
   PHP_INSTALL_HEADERS([ext/fiber], [config.h include/*.h])
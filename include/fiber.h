@@ -16,15 +16,53 @@
 
 #include "php.h"
 
+#include "fiber_timer.h"
+#include "fiber_local.h"
+
 BEGIN_EXTERN_C()
 
 void zend_fiber_ce_register();
 void zend_fiber_ce_unregister();
 
+void zend_fiber_startup();
 void zend_fiber_shutdown();
 
+uint64_t zend_fiber_clock();
+
 typedef void* zend_fiber_context;
 typedef struct _zend_fiber zend_fiber;
+typedef struct _zend_fiber_queue zend_fiber_queue;
+
+/* Intrusive FIFO of fibers, linked through the queue fields of zend_fiber. */
+struct _zend_fiber_queue {
+	zend_fiber *head;
+	zend_fiber *tail;
+	uint32_t size;
+};
+
+/* Counters of the fiber runtime, kept per thread for the lifetime of the process. */
+typedef struct _zend_fiber_stats {
+	/* Native fibers created, and failures to create one. */
+	zend_ulong created;
+	zend_ulong create_failures;
+
+	/* Fibers that returned or were terminated by an exception (or destroyed while suspended). */
+	zend_ulong finished;
+	zend_ulong dead;
+
+	/* Context switches into and out of fibers. */
+	zend_ulong switches;
+
+	/* VM stack segments beyond the first one released when a fiber ends, i.e. segments zend_vm_stack_extend()
+	 * had to add. Segments of fibers still running are not included. */
+	zend_ulong vm_stack_segments_released;
+
+	/* Fibers currently suspended. */
+	uint32_t suspended;
+
+	/* Bytes of C stacks currently mapped, including guard pages and pooled stacks. */
+	size_t stack_mapped;
+} zend_fiber_stats;
 
 struct _zend_fiber {
 	/* Fiber PHP object handle. */
@@ -37,7 +75,8 @@ struct _zend_fiber {
 	zend_fcall_info fci;
 	zend_fcall_info_cache fci_cache;
 
-	/* Fiber context of this fiber, will be created during call to start(). */
+	/* Fiber context of this fiber, will be created during call to start(). It shares one
+	 * allocation with the C stack and the first VM stack segment. */
 	zend_fiber_context context;
 
 	/* Destination for a PHP value being passed into or returned from the fiber. */
@@ -51,6 +90,60 @@ struct _zend_fiber {
 
 	/* Max size of the C stack being used by the fiber. */
 	size_t stack_size;
+
+	/* Links into the list of idle suspended fibers and time (ns) of suspension. */
+	zend_fiber *idle_prev;
+	zend_fiber *idle_next;
+	uint64_t suspended_at;
+	zend_bool idle;
+
+	/* Run queue or wait queue the fiber is linked into, NULL if it is in none. */
+	zend_fiber_queue *queue;
+	zend_fiber *queue_prev;
+	zend_fiber *queue_next;
+
+	/* Value passed into the fiber when the scheduler resumes it. */
+	zval send;
+
+	/* Fibers waiting in Fiber::await() for this fiber to terminate. */
+	zend_fiber_queue awaiters;
+
+	/* Return value of the fiber callback, set once the fiber has finished. */
+	zval retval;
+
+	/* Fiber holds a reference to itself while it is on the run queue or parked. The reference of a fiber parked in a
+	 * wait queue owned by an object (channel, sync primitive, awaited fiber) is reported by the get_gc handler of
+	 * that object, fibers waiting for I/O or a timer remain roots. */
+	zend_bool attached;
+
+	/* Reactor events the fiber is waiting for while it is linked into a watcher. */
+	int poll_events;
+
+	/* Set while the fiber is suspended in zend_fiber_park(), waiting for I/O, a timer or another fiber. */
+	zend_bool parked;
+
+	/* Cancellation token of the fiber, NULL if neither the fiber nor the fiber that started it can be cancelled. */
+	struct _zend_fiber_cancellation *cancellation;
+
+	/* Fiber-local storage. */
+	zend_fiber_locals locals;
+
+	/* Values reported to the cycle collector, rebuilt on every call of the get_gc handler. */
+	zval *gc_buffer;
+	uint32_t gc_size;
+
+	/* Value slot on the C stack of a fiber blocked on a channel, synchronization primitive or offloaded task. */
+	zval *wait_value;
+
+	/* Start (ns) of the current run slice, total run time (ns), number of slices and the longest one (ns).
+	 * Only maintained if fiber.profile is enabled. */
+	uint64_t slice_start;
+	uint64_t run_time;
+	zend_ulong slices;
+	uint64_t slice_max;
+
+	/* Wakes the fiber up when it sleeps or waits with a timeout. */
+	zend_fiber_timer timer;
 };
 
 static const zend_uchar ZEND_FIBER_STATUS_INIT = 0;
@@ -59,17 +152,32 @@ static const zend_uchar ZEND_FIBER_STATUS_RUNNING = 2;
 static const zend_uchar ZEND_FIBER_STATUS_FINISHED = 3;
 static const zend_uchar ZEND_FIBER_STATUS_DEAD = 4;
 
+extern zend_class_entry *zend_ce_fiber;
+
+zend_bool zend_fiber_switch_to(zend_fiber *fiber);
+zend_bool zend_fiber_start(zend_fiber *fiber, zval *params, uint32_t param_count, zval *return_value);
+zend_bool zend_fiber_resume(zend_fiber *fiber, zval *value, zval *return_value);
+zend_bool zend_fiber_pause(zend_fiber *fiber, zval *value, zval *return_value);
+zend_bool zend_fiber_transfer(zend_fiber *fiber, zend_fiber *next, zval *value, zval *return_value);
+
+#define ZEND_FIBER_FROM_TIMER(t) ((zend_fiber *) (((char *) (t)) - XtOffsetOf(zend_fiber, timer)))
+
 typedef void (* zend_fiber_func)();
 
 zend_fiber_context zend_fiber_create_root_context();
-zend_fiber_context zend_fiber_create_context();
 
-zend_bool zend_fiber_create(zend_fiber_context context, zend_fiber_func func, size_t stack_size);
+/* Creates a context running func on a C stack of stack_size bytes. A block of reserved_size
+ * bytes is carved from the same allocation and returned in reserved, it lives as long as the context. */
+zend_fiber_context zend_fiber_create(zend_fiber_func func, size_t stack_size, size_t reserved_size, void **reserved);
 void zend_fiber_destroy(zend_fiber_context context);
 
 zend_bool zend_fiber_switch_context(zend_fiber_context current, zend_fiber_context next);
+zend_bool zend_fiber_transfer_context(zend_fiber_context current, zend_fiber_context next);
 zend_bool zend_fiber_suspend(zend_fiber_context current);
 
+size_t zend_fiber_stack_usage(zend_fiber_context context);
+void zend_fiber_reclaim(zend_fiber_context context);
+
 END_EXTERN_C()
 
 #define REGISTER_FIBER_CLASS_CONST_LONG(const_name, value) \
@@ -77,6 +185,12 @@ END_EXTERN_C()
 
 #define ZEND_FIBER_VM_STACK_SIZE 4096
 
+/* Default C stack size, used when neither fiber.stack_size nor a constructor argument is given. */
+#define ZEND_FIBER_DEFAULT_STACK_SIZE (ZEND_FIBER_VM_STACK_SIZE * (((sizeof(void *)) < 8) ? 16 : 128))
+
+/* Smallest C stack size accepted, guard pages are allocated in addition to it. */
+#define ZEND_FIBER_MIN_STACK_SIZE (ZEND_FIBER_VM_STACK_SIZE * 4)
+
 #endif
 
 /*
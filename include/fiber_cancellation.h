@@ -0,0 +1,76 @@
+/*
+  +--------------------------------------------------------------------+
+  | ext-fiber                                                          |
+  +--------------------------------------------------------------------+
+  | Redistribution and use in source and binary forms, with or without |
+  | modification, are permitted provided that the conditions mentioned |
+  | in the accompanying LICENSE file are met.                          |
+  +--------------------------------------------------------------------+
+  | Authors: Martin Schröder <m.schroeder2007@gmail.com>               |
+  |          Aaron Piotrowski <aaron@trowski.com>                      |
+  +--------------------------------------------------------------------+
+*/
+
+#ifndef FIBER_CANCELLATION_H
+#define FIBER_CANCELLATION_H
+
+#include "fiber.h"
+
+#define ZEND_FIBER_CANCELLED 1
+#define ZEND_FIBER_DEADLINE_EXCEEDED 2
+
+typedef struct _zend_fiber_cancellation zend_fiber_cancellation;
+
+/* Cancellation state of a fiber. Tokens form a tree mirroring which fiber started which one, cancelling a token
+ * cancels all tokens below it. */
+struct _zend_fiber_cancellation {
+	uint32_t refcount;
+
+	/* 0 or the reason of the cancellation, one of the constants above. */
+	zend_uchar cancelled;
+
+	/* Fiber the token belongs to, NULL once the fiber has been freed. */
+	zend_fiber *fiber;
+
+	/* Token of the fiber that started the fiber (counted reference), children are not referenced. */
+	zend_fiber_cancellation *parent;
+	zend_fiber_cancellation *children;
+	zend_fiber_cancellation *prev;
+	zend_fiber_cancellation *next;
+
+	/* Cancels the token once the deadline of the fiber has passed. */
+	zend_fiber_timer timer;
+};
+
+BEGIN_EXTERN_C()
+
+void zend_fiber_cancellation_ce_register();
+
+/* Returns the token owned by the fiber, creating it if the fiber has none. */
+zend_fiber_cancellation *zend_fiber_cancellation_get(zend_fiber *fiber);
+
+/* Links the token of a fiber that is about to be started below the token of the fiber starting it, both tokens are
+ * created if necessary. */
+void zend_fiber_cancellation_inherit(zend_fiber *fiber, zend_fiber *parent);
+
+void zend_fiber_cancellation_cancel(zend_fiber_cancellation *token, zend_uchar reason);
+
+/* Cancels the fiber and all fibers it starts from now on once the deadline (ns of zend_fiber_clock()) has passed. */
+void zend_fiber_cancellation_set_deadline(zend_fiber *fiber, uint64_t deadline);
+
+void zend_fiber_cancellation_release(zend_fiber *fiber);
+
+/* Throws a FiberCancelledError and returns 0 if the fiber has been cancelled. */
+zend_bool zend_fiber_cancellation_check(zend_fiber *fiber);
+
+END_EXTERN_C()
+
+#define ZEND_FIBER_CANCELLATION_FROM_TIMER(t) \
+	((zend_fiber_cancellation *) (((char *) (t)) - XtOffsetOf(zend_fiber_cancellation, timer)))
+
+#endif
+
+/*
+ * vim: sw=4 ts=4
+ * vim600: fdm=marker
+ */
@@ -0,0 +1,51 @@
+/*
+  +--------------------------------------------------------------------+
+  | ext-fiber                                                          |
+  +--------------------------------------------------------------------+
+  | Redistribution and use in source and binary forms, with or without |
+  | modification, are permitted provided that the conditions mentioned |
+  | in the accompanying LICENSE file are met.                          |
+  +--------------------------------------------------------------------+
+  | Authors: Martin Schröder <m.schroeder2007@gmail.com>               |
+  |          Aaron Piotrowski <aaron@trowski.com>                      |
+  +--------------------------------------------------------------------+
+*/
+
+#ifndef FIBER_CHANNEL_H
+#define FIBER_CHANNEL_H
+
+#include "fiber.h"
+
+typedef struct _zend_fiber_channel {
+	/* Channel PHP object handle. */
+	zend_object std;
+
+	/* Ring buffer of capacity values, unused slots are undef. */
+	zval *buffer;
+	uint32_t capacity;
+	uint32_t head;
+	uint32_t count;
+
+	/* Fibers blocked in send() / receive(), each one exposes its value through wait_value. */
+	zend_fiber_queue senders;
+	zend_fiber_queue receivers;
+
+	/* Values reported to the cycle collector, rebuilt on every call of the get_gc handler. */
+	zval *gc_buffer;
+	uint32_t gc_size;
+
+	zend_bool closed;
+} zend_fiber_channel;
+
+BEGIN_EXTERN_C()
+
+void zend_fiber_channel_ce_register();
+
+END_EXTERN_C()
+
+#endif
+
+/*
+ * vim: sw=4 ts=4
+ * vim600: fdm=marker
+ */
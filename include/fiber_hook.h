@@ -0,0 +1,32 @@
+/*
+  +--------------------------------------------------------------------+
+  | ext-fiber                                                          |
+  +--------------------------------------------------------------------+
+  | Redistribution and use in source and binary forms, with or without |
+  | modification, are permitted provided that the conditions mentioned |
+  | in the accompanying LICENSE file are met.                          |
+  +--------------------------------------------------------------------+
+  | Authors: Martin Schröder <m.schroeder2007@gmail.com>               |
+  |          Aaron Piotrowski <aaron@trowski.com>                      |
+  +--------------------------------------------------------------------+
+*/
+
+#ifndef FIBER_HOOK_H
+#define FIBER_HOOK_H
+
+#include "php.h"
+
+BEGIN_EXTERN_C()
+
+/* Installs hooks into socket transports and sleep functions if fiber.hook_blocking is enabled. */
+void zend_fiber_hook_startup();
+void zend_fiber_hook_shutdown();
+
+END_EXTERN_C()
+
+#endif
+
+/*
+ * vim: sw=4 ts=4
+ * vim600: fdm=marker
+ */
@@ -0,0 +1,70 @@
+/*
+  +--------------------------------------------------------------------+
+  | ext-fiber                                                          |
+  +--------------------------------------------------------------------+
+  | Redistribution and use in source and binary forms, with or without |
+  | modification, are permitted provided that the conditions mentioned |
+  | in the accompanying LICENSE file are met.                          |
+  +--------------------------------------------------------------------+
+  | Authors: Martin Schröder <m.schroeder2007@gmail.com>               |
+  |          Aaron Piotrowski <aaron@trowski.com>                      |
+  +--------------------------------------------------------------------+
+*/
+
+#ifndef FIBER_IO_H
+#define FIBER_IO_H
+
+#include "php_network.h"
+
+#include "fiber.h"
+
+#define ZEND_FIBER_IO_READ 0
+#define ZEND_FIBER_IO_WRITE 1
+#define ZEND_FIBER_IO_FSYNC 2
+
+typedef struct _zend_fiber_io_request zend_fiber_io_request;
+
+typedef struct _zend_fiber_io {
+	/* io_uring instance, created on first use, NULL if not created (yet). */
+	void *ring;
+
+	/* io_uring could not be set up, the readiness based fallback is used. */
+	zend_bool unavailable;
+
+	/* Operations prepared but not yet handed to the kernel, they are submitted in one batch per tick. */
+	uint32_t queued;
+
+	/* Operations submitted or queued whose completion has not been reaped yet. */
+	uint32_t inflight;
+
+	/* In-flight operations, linked to be able to cancel them on shutdown. */
+	zend_fiber_io_request *requests;
+} zend_fiber_io;
+
+BEGIN_EXTERN_C()
+
+void zend_fiber_io_startup();
+void zend_fiber_io_shutdown();
+
+/* Performs op on fd, suspending the fiber until it has completed. Data is read into or written from buffer,
+ * which is kept alive until the kernel is done with it. Returns the result of the operation or -errno. */
+zend_long zend_fiber_io_perform(zend_fiber *fiber, int op, php_socket_t fd, zend_string *buffer, size_t length, zend_off_t offset);
+
+/* Hands queued operations to the kernel and schedules the fibers of completed ones. Returns the number of
+ * completed operations. */
+int zend_fiber_io_flush();
+
+/* Schedules the fibers of completed operations, returns their number. */
+int zend_fiber_io_reap();
+
+/* Checks whether any operation is in flight. */
+zend_bool zend_fiber_io_pending();
+
+END_EXTERN_C()
+
+#endif
+
+/*
+ * vim: sw=4 ts=4
+ * vim600: fdm=marker
+ */
@@ -0,0 +1,49 @@
+/*
+  +--------------------------------------------------------------------+
+  | ext-fiber                                                          |
+  +--------------------------------------------------------------------+
+  | Redistribution and use in source and binary forms, with or without |
+  | modification, are permitted provided that the conditions mentioned |
+  | in the accompanying LICENSE file are met.                          |
+  +--------------------------------------------------------------------+
+  | Authors: Martin Schröder <m.schroeder2007@gmail.com>               |
+  |          Aaron Piotrowski <aaron@trowski.com>                      |
+  +--------------------------------------------------------------------+
+*/
+
+#ifndef FIBER_LOCAL_H
+#define FIBER_LOCAL_H
+
+#include "php.h"
+
+/* Slot is copied into fibers started by the fiber holding it. */
+#define ZEND_FIBER_LOCAL_INHERIT 1
+
+/* Values of fiber-local storage, indexed by the slot numbers handed out by FiberLocal::register(). */
+typedef struct _zend_fiber_locals {
+	zval *slots;
+	uint32_t size;
+
+	/* Set once inheritable slots have been copied from the starting fiber. */
+	zend_bool inherited;
+} zend_fiber_locals;
+
+BEGIN_EXTERN_C()
+
+void zend_fiber_local_ce_register();
+
+void zend_fiber_local_startup();
+void zend_fiber_local_shutdown();
+
+/* Copies inheritable slots of the running fiber (or the main context) into a fiber about to be started. */
+void zend_fiber_locals_inherit(zend_fiber_locals *locals);
+void zend_fiber_locals_destroy(zend_fiber_locals *locals);
+
+END_EXTERN_C()
+
+#endif
+
+/*
+ * vim: sw=4 ts=4
+ * vim600: fdm=marker
+ */
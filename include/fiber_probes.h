@@ -0,0 +1,39 @@
+/*
+  +--------------------------------------------------------------------+
+  | ext-fiber                                                          |
+  +--------------------------------------------------------------------+
+  | Redistribution and use in source and binary forms, with or without |
+  | modification, are permitted provided that the conditions mentioned |
+  | in the accompanying LICENSE file are met.                          |
+  +--------------------------------------------------------------------+
+  | Authors: Martin Schröder <m.schroeder2007@gmail.com>               |
+  |          Aaron Piotrowski <aaron@trowski.com>                      |
+  +--------------------------------------------------------------------+
+*/
+
+
+#ifndef FIBER_PROBES_H
+#define FIBER_PROBES_H
+
+/* Static probes (provider "fiber") for bpftrace, perf and SystemTap, compiled in with --enable-fiber-dtrace.
+ * Every probe carries the object handle of the fiber and the stack pointer of the context firing it, which is
+ * the fiber's own stack for start, suspend, resume, throw and finish. */
+#ifdef HAVE_FIBER_DTRACE
+
+#include <sys/sdt.h>
+
+#define ZEND_FIBER_PROBE(name, f) \
+	DTRACE_PROBE2(fiber, name, (f)->std.handle, __builtin_frame_address(0))
+
+#else
+
+#define ZEND_FIBER_PROBE(name, f)
+
+#endif
+
+#endif
+
+/*
+ * vim: sw=4 ts=4
+ * vim600: fdm=marker
+ */
@@ -0,0 +1,97 @@
+/*
+  +--------------------------------------------------------------------+
+  | ext-fiber                                                          |
+  +--------------------------------------------------------------------+
+  | Redistribution and use in source and binary forms, with or without |
+  | modification, are permitted provided that the conditions mentioned |
+  | in the accompanying LICENSE file are met.                          |
+  +--------------------------------------------------------------------+
+  | Authors: Martin Schröder <m.schroeder2007@gmail.com>               |
+  |          Aaron Piotrowski <aaron@trowski.com>                      |
+  +--------------------------------------------------------------------+
+*/
+
+#ifndef FIBER_REACTOR_H
+#define FIBER_REACTOR_H
+
+#include "php_network.h"
+
+#include "fiber.h"
+
+#define ZEND_FIBER_READABLE 1
+#define ZEND_FIBER_WRITABLE 2
+
+/* Max number of readiness events fetched from the kernel per poll. */
+#define ZEND_FIBER_REACTOR_EVENTS 256
+
+/* Collects completions of a completion source, returns their number. */
+typedef int (* zend_fiber_reap_func)();
+
+typedef struct _zend_fiber_watcher {
+	php_socket_t fd;
+
+	/* Set for the fd of a completion source (io_uring, thread pool), invoked whenever the fd is readable. */
+	zend_fiber_reap_func reap;
+
+	/* Events currently registered with the backend. */
+	int events;
+
+	/* Fibers waiting for events on the fd, each one records its events in poll_events. */
+	zend_fiber_queue waiters;
+} zend_fiber_watcher;
+
+typedef struct _zend_fiber_reactor {
+	/* Watchers keyed by fd, a watcher exists as long as fibers are waiting on its fd. */
+	HashTable watchers;
+
+	/* Number of watchers with events registered with the backend. */
+	uint32_t pending;
+
+	/* Number of watched completion sources, they are not counted as pending. */
+	uint32_t completions;
+
+	/* epoll instance and its event buffer, created on first use (-1 / NULL otherwise). */
+	int backend_fd;
+	void *backend_events;
+
+	/* Watchers are only available while a request is active. */
+	zend_bool active;
+} zend_fiber_reactor;
+
+BEGIN_EXTERN_C()
+
+void zend_fiber_reactor_ce_register();
+
+void zend_fiber_reactor_startup();
+void zend_fiber_reactor_shutdown();
+
+/* Suspends the fiber until one of the events occurs on fd, the ready events are stored in return_value. */
+zend_bool zend_fiber_reactor_wait(zend_fiber *fiber, php_socket_t fd, int events, zval *return_value);
+
+/* Resumes all fibers waiting on fd with an error and drops its watcher, must be called before fd is closed. */
+void zend_fiber_reactor_close(php_socket_t fd);
+
+/* Registers the fd of a completion source, reap is invoked from the poll whenever the fd is readable. */
+zend_bool zend_fiber_reactor_watch_completions(php_socket_t fd, zend_fiber_reap_func reap);
+
+/* Unregisters the fd of a completion source, must be called before fd is closed. */
+void zend_fiber_reactor_unwatch_completions(php_socket_t fd);
+
+/* Gives the child of a fork its own epoll instance, the inherited one is shared with the parent. */
+void zend_fiber_reactor_fork();
+
+/* Checks whether any fiber is waiting for I/O. */
+zend_bool zend_fiber_reactor_pending();
+
+/* Waits up to timeout milliseconds (-1 to block) for I/O and schedules all fibers whose events
+ * occurred, sleeps if no fiber waits for I/O. Returns the number of ready watchers or -1 on failure. */
+int zend_fiber_reactor_poll(zend_long timeout);
+
+END_EXTERN_C()
+
+#endif
+
+/*
+ * vim: sw=4 ts=4
+ * vim600: fdm=marker
+ */
@@ -0,0 +1,48 @@
+/*
+  +--------------------------------------------------------------------+
+  | ext-fiber                                                          |
+  +--------------------------------------------------------------------+
+  | Redistribution and use in source and binary forms, with or without |
+  | modification, are permitted provided that the conditions mentioned |
+  | in the accompanying LICENSE file are met.                          |
+  +--------------------------------------------------------------------+
+  | Authors: Martin Schröder <m.schroeder2007@gmail.com>               |
+  |          Aaron Piotrowski <aaron@trowski.com>                      |
+  +--------------------------------------------------------------------+
+*/
+
+#ifndef FIBER_SCHEDULER_H
+#define FIBER_SCHEDULER_H
+
+#include "fiber.h"
+
+BEGIN_EXTERN_C()
+
+void zend_fiber_scheduler_ce_register();
+
+void zend_fiber_scheduler_startup();
+
+void zend_fiber_queue_push(zend_fiber_queue *queue, zend_fiber *fiber);
+zend_fiber *zend_fiber_queue_shift(zend_fiber_queue *queue);
+void zend_fiber_queue_remove(zend_fiber *fiber);
+
+/* Appends the parked fibers of a wait queue owned by an object to the get_gc buffer of the object, starting at
+ * count. Returns the new number of values in the buffer. */
+uint32_t zend_fiber_queue_gc(zend_fiber_queue *queue, zval **buffer, uint32_t *size, uint32_t count);
+
+void zend_fiber_attach(zend_fiber *fiber);
+void zend_fiber_schedule(zend_fiber *fiber, zval *value);
+zend_bool zend_fiber_park(zend_fiber *fiber, zval *return_value);
+void zend_fiber_notify_awaiters(zend_fiber *fiber);
+
+/* Timer callback scheduling the fiber the timer is embedded in. */
+void zend_fiber_wakeup(zend_fiber_timer *timer);
+
+END_EXTERN_C()
+
+#endif
+
+/*
+ * vim: sw=4 ts=4
+ * vim600: fdm=marker
+ */
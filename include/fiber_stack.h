@@ -18,13 +18,25 @@ typedef struct _zend_fiber_stack {
 	void *pointer;
 	size_t size;
 
+	/* Stack has been painted with the canary pattern to measure its usage. */
+	zend_bool watermark;
+
+	/* Time (ns) the stack was returned to the pool, 0 once its pages have been reclaimed. */
+	uint64_t released_at;
+
 #ifdef ZEND_FIBER_VALGRIND
 	int valgrind;
 #endif
 } zend_fiber_stack;
 
-zend_bool zend_fiber_stack_allocate(zend_fiber_stack *stack, unsigned int size);
+zend_bool zend_fiber_stack_allocate(zend_fiber_stack *stack, size_t size);
 void zend_fiber_stack_free(zend_fiber_stack *stack);
+size_t zend_fiber_stack_measure(zend_fiber_stack *stack);
+void zend_fiber_stack_reclaim(zend_fiber_stack *stack, void *sp);
+
+void zend_fiber_stack_pool_init();
+void zend_fiber_stack_pool_reclaim(uint64_t now, uint64_t threshold);
+void zend_fiber_stack_pool_shutdown();
 
 #if _POSIX_MAPPED_FILES
 #define ZEND_FIBER_MMAP 1
@@ -40,6 +52,24 @@ void zend_fiber_stack_free(zend_fiber_stack *stack);
 #endif
 #endif
 
+#ifdef MAP_STACK
+#define ZEND_FIBER_MAP_STACK MAP_STACK
+#else
+#define ZEND_FIBER_MAP_STACK 0
+#endif
+
+#ifdef MAP_NORESERVE
+#define ZEND_FIBER_MAP_NORESERVE MAP_NORESERVE
+#else
+#define ZEND_FIBER_MAP_NORESERVE 0
+#endif
+
+#if defined(MADV_DONTNEED)
+#define ZEND_FIBER_MADVISE MADV_DONTNEED
+#elif defined(MADV_FREE)
+#define ZEND_FIBER_MADVISE MADV_FREE
+#endif
+
 #endif
 
 #if _POSIX_MEMORY_PROTECTION
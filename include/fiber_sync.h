@@ -0,0 +1,49 @@
+/*
+  +--------------------------------------------------------------------+
+  | ext-fiber                                                          |
+  +--------------------------------------------------------------------+
+  | Redistribution and use in source and binary forms, with or without |
+  | modification, are permitted provided that the conditions mentioned |
+  | in the accompanying LICENSE file are met.                          |
+  +--------------------------------------------------------------------+
+  | Authors: Martin Schröder <m.schroeder2007@gmail.com>               |
+  |          Aaron Piotrowski <aaron@trowski.com>                      |
+  +--------------------------------------------------------------------+
+*/
+
+#ifndef FIBER_SYNC_H
+#define FIBER_SYNC_H
+
+#include "fiber.h"
+
+/* State shared by FiberMutex, FiberSemaphore and FiberWaitGroup. */
+typedef struct _zend_fiber_sync {
+	/* PHP object handle. */
+	zend_object std;
+
+	/* Fibers blocked on the primitive, they are resumed in FIFO order. */
+	zend_fiber_queue waiters;
+
+	/* 1 while a mutex is locked, free permits of a semaphore or pending tasks of a wait group. */
+	zend_long count;
+
+	/* Fiber holding a mutex, NULL if the mutex is unlocked or held outside of a fiber. */
+	zend_fiber *owner;
+
+	/* Parked fibers reported to the cycle collector, rebuilt on every call of the get_gc handler. */
+	zval *gc_buffer;
+	uint32_t gc_size;
+} zend_fiber_sync;
+
+BEGIN_EXTERN_C()
+
+void zend_fiber_sync_ce_register();
+
+END_EXTERN_C()
+
+#endif
+
+/*
+ * vim: sw=4 ts=4
+ * vim600: fdm=marker
+ */
@@ -0,0 +1,111 @@
+/*
+  +--------------------------------------------------------------------+
+  | ext-fiber                                                          |
+  +--------------------------------------------------------------------+
+  | Redistribution and use in source and binary forms, with or without |
+  | modification, are permitted provided that the conditions mentioned |
+  | in the accompanying LICENSE file are met.                          |
+  +--------------------------------------------------------------------+
+  | Authors: Martin Schröder <m.schroeder2007@gmail.com>               |
+  |          Aaron Piotrowski <aaron@trowski.com>                      |
+  +--------------------------------------------------------------------+
+*/
+
+
+#ifndef FIBER_THREAD_H
+#define FIBER_THREAD_H
+
+#include "php.h"
+#include "php_network.h"
+
+#include "fiber.h"
+
+typedef struct _zend_fiber_task zend_fiber_task;
+
+/* Runs in a worker thread, must neither call into the engine nor allocate with emalloc(). */
+typedef void (* zend_fiber_task_func)(zend_fiber_task *task);
+
+struct _zend_fiber_task {
+	zend_fiber_task_func func;
+
+	/* Fiber waiting for the task, NULL once it has stopped waiting (the task is freed on completion then). */
+	zend_fiber *fiber;
+
+	/* Completion queue of the request that submitted the task. */
+	struct _zend_fiber_tasks *owner;
+
+	/* Links the task into the submission queue of the pool and the completion queue of its owner. */
+	zend_fiber_task *next;
+
+	/* Links the task into the in-flight list of its owner, only used by the request thread. */
+	zend_fiber_task *inflight_prev;
+	zend_fiber_task *inflight_next;
+
+	/* Set if the worker running the task did not survive a fork. */
+	zend_bool cancelled;
+
+	/* Input and output of the task, both allocated with malloc() as workers cannot use the request heap. */
+	char *arg;
+	char *result;
+	size_t length;
+
+	/* errno or getaddrinfo() error reported by the task, 0 on success. */
+	int error;
+
+	zend_stat_t st;
+};
+
+typedef struct _zend_fiber_tasks {
+	/* Tasks completed by workers, a lock-free stack that is swapped out by the request thread as a whole. */
+	zend_fiber_task *completed;
+
+	/* Written to by a worker whenever completed stops being empty, watched by the reactor (-1 if unused). */
+	php_socket_t notify_read;
+	php_socket_t notify_write;
+
+	/* Held by the request and by every submitted task until its worker has published it. The queue is allocated
+	 * with malloc() and freed by whoever drops the last reference, a request does not wait for its workers. */
+	uint32_t refcount;
+
+	/* Set once the request has ended, workers skip the remaining tasks of the queue. */
+	zend_bool abandoned;
+
+	/* Submitted tasks that have not been reaped yet. */
+	zend_fiber_task *inflight;
+} zend_fiber_tasks;
+
+BEGIN_EXTERN_C()
+
+void zend_fiber_thread_ce_register();
+
+void zend_fiber_tasks_startup();
+void zend_fiber_tasks_shutdown();
+
+/* Seconds the shutdown of the process waits for workers to exit. */
+#define ZEND_FIBER_THREAD_POOL_JOIN_TIMEOUT 1
+
+/* Stops and joins the worker threads, they are shared by all requests of the process. Returns 0 if some of them are
+ * still blocked in a task after ZEND_FIBER_THREAD_POOL_JOIN_TIMEOUT, they are detached then. */
+zend_bool zend_fiber_thread_pool_shutdown();
+
+/* Hands the task to a worker and suspends the fiber until it has completed. Returns 1 if the task is done,
+ * 0 if the fiber has been resumed early or the request has ended (the task is released on completion then).
+ * Without worker threads the task is run right away. Tasks must be allocated with malloc(). */
+zend_bool zend_fiber_task_run(zend_fiber *fiber, zend_fiber_task *task);
+
+void zend_fiber_task_free(zend_fiber_task *task);
+
+/* Schedules the fibers of completed tasks, returns their number. */
+int zend_fiber_tasks_reap();
+
+/* Checks whether any task is in flight. */
+zend_bool zend_fiber_tasks_pending();
+
+END_EXTERN_C()
+
+#endif
+
+/*
+ * vim: sw=4 ts=4
+ * vim600: fdm=marker
+ */
@@ -0,0 +1,86 @@
+/*
+  +--------------------------------------------------------------------+
+  | ext-fiber                                                          |
+  +--------------------------------------------------------------------+
+  | Redistribution and use in source and binary forms, with or without |
+  | modification, are permitted provided that the conditions mentioned |
+  | in the accompanying LICENSE file are met.                          |
+  +--------------------------------------------------------------------+
+  | Authors: Martin Schröder <m.schroeder2007@gmail.com>               |
+  |          Aaron Piotrowski <aaron@trowski.com>                      |
+  +--------------------------------------------------------------------+
+*/
+
+#ifndef FIBER_TIMER_H
+#define FIBER_TIMER_H
+
+#include "php.h"
+
+/* Length of a wheel tick in nanoseconds, deadlines are rounded up to whole ticks. */
+#define ZEND_FIBER_TIMER_RESOLUTION 1000000
+
+/* Each level has 64 slots covering 64 slots of the level below, 6 levels span about 2 years. */
+#define ZEND_FIBER_TIMER_LEVELS 6
+#define ZEND_FIBER_TIMER_SLOT_BITS 6
+#define ZEND_FIBER_TIMER_SLOTS (1 << ZEND_FIBER_TIMER_SLOT_BITS)
+
+typedef struct _zend_fiber_timer zend_fiber_timer;
+
+typedef void (* zend_fiber_timer_func)(zend_fiber_timer *timer);
+
+/* Timers are embedded in the structure they belong to, the wheel does not allocate. */
+struct _zend_fiber_timer {
+	/* Deadline in ticks. */
+	uint64_t expires;
+
+	/* Invoked once the deadline has passed, the timer is inactive at that point. */
+	zend_fiber_timer_func func;
+
+	zend_fiber_timer *prev;
+	zend_fiber_timer *next;
+
+	/* Wheel slot the timer is linked into, NULL if the timer is not active. */
+	zend_fiber_timer **slot;
+};
+
+typedef struct _zend_fiber_timer_wheel {
+	zend_fiber_timer *slots[ZEND_FIBER_TIMER_LEVELS][ZEND_FIBER_TIMER_SLOTS];
+
+	/* Bitmap of non-empty slots per level. */
+	uint64_t occupied[ZEND_FIBER_TIMER_LEVELS];
+
+	/* Tick the wheel has been advanced to. */
+	uint64_t now;
+
+	/* Number of active timers. */
+	uint32_t count;
+} zend_fiber_timer_wheel;
+
+BEGIN_EXTERN_C()
+
+void zend_fiber_timer_startup();
+void zend_fiber_timer_shutdown();
+
+/* Converts a relative timeout in seconds into a deadline, negative timeouts are due immediately. */
+uint64_t zend_fiber_timer_deadline(double seconds);
+
+/* Activates the timer, deadline is given in nanoseconds of zend_fiber_clock(). */
+void zend_fiber_timer_start(zend_fiber_timer *timer, uint64_t deadline, zend_fiber_timer_func func);
+void zend_fiber_timer_stop(zend_fiber_timer *timer);
+
+/* Milliseconds until the next timer has to be processed, -1 if there are no timers. */
+zend_long zend_fiber_timer_timeout();
+
+/* Advances the wheel to the current time and invokes all expired timers, returns their number. */
+int zend_fiber_timer_advance();
+
+END_EXTERN_C()
+
+#define ZEND_FIBER_TIMER_ACTIVE(timer) ((timer)->slot != NULL)
+
+#endif
+
+/*
+ * vim: sw=4 ts=4
+ * vim600: fdm=marker
+ */
@@ -15,12 +15,22 @@
 #define PHP_FIBER_H
 
 #include "fiber.h"
+#include "fiber_reactor.h"
+#include "fiber_io.h"
+#include "fiber_thread.h"
 
 extern zend_module_entry fiber_module_entry;
 #define phpext_fiber_ptr &fiber_module_entry
 
 #define PHP_FIBER_VERSION "0.1.0"
 
+/* Buckets of the stack usage histogram, bucket n counts usage below 2^(n + 1) bytes. */
+#define ZEND_FIBER_STACK_USAGE_BUCKETS 32
+
+/* Buckets of the run slice histogram, bucket n counts slices shorter than 2^(n + 1) microseconds,
+ * the last bucket is open-ended. */
+#define ZEND_FIBER_SLICE_BUCKETS 32
+
 #if defined(ZTS) && defined(COMPILE_DL_FIBER)
 ZEND_TSRMLS_CACHE_EXTERN()
 #endif
@@ -35,9 +45,95 @@ ZEND_BEGIN_MODULE_GLOBALS(fiber)
 	/* Default fiber C stack size. */
 	zend_long stack_size;
 
+	/* Size of the first VM stack segment of a fiber (fiber.vm_stack_size). */
+	zend_long vm_stack_size;
+
+	/* Max number of C stacks kept for reuse by the stack pool. */
+	zend_long stack_pool_size;
+
+	/* Free list of recycled C stacks, linked through the stacks themselves. */
+	void *stack_pool;
+
+	/* Number of C stacks currently held by the stack pool. */
+	uint32_t stack_pool_count;
+
+	/* Stacks are only pooled while a request is active. */
+	zend_bool stack_pool_active;
+
+	/* Stack allocations served from / missed by the stack pool. */
+	zend_ulong stack_pool_hits;
+	zend_ulong stack_pool_misses;
+
+	/* Map C stacks without reserving swap space up front (fiber.stack_noreserve). */
+	zend_bool stack_noreserve;
+
+	/* Paint C stacks to measure their high-water mark (fiber.stack_watermark). */
+	zend_bool stack_watermark;
+
+	/* Number of measured stacks, highest usage seen and log2 histogram of usage. */
+	zend_ulong stack_usage_samples;
+	size_t stack_usage_peak;
+	zend_ulong stack_usage_histogram[ZEND_FIBER_STACK_USAGE_BUCKETS];
+
+	/* Milliseconds a stack may stay idle before its pages are released (fiber.stack_reclaim_threshold). */
+	zend_long stack_reclaim_threshold;
+
+	/* Suspended fibers whose stacks have not been reclaimed yet, oldest first. */
+	zend_fiber *idle_head;
+	zend_fiber *idle_tail;
+
+	/* Earliest time (ns) of the next sweep for idle stacks. */
+	uint64_t reclaim_at;
+
+	/* Runtime counters exposed by Fiber::getStats() and phpinfo(). */
+	zend_fiber_stats stats;
+
+	/* Measure the time fibers run between switches (fiber.profile). */
+	zend_bool profile;
+
+	/* Number of measured run slices, the longest one (ns) and log2 histogram of their lengths. */
+	zend_ulong slice_samples;
+	uint64_t slice_peak;
+	zend_ulong slice_histogram[ZEND_FIBER_SLICE_BUCKETS];
+
 	/* Error to be thrown into a fiber (will be populated by throw()). */
 	zval *error;
 
+	/* Fibers ready to be run by the scheduler. */
+	zend_fiber_queue run_queue;
+
+	/* Set while FiberScheduler::run() is active. */
+	zend_bool scheduler_running;
+
+	/* Fiber that has just terminated or suspended itself, the scheduler reference is released by its caller. */
+	zend_fiber *released;
+
+	/* Fibers waiting for readiness of file descriptors. */
+	zend_fiber_reactor reactor;
+
+	/* Completion based I/O engine (io_uring), readiness of the reactor is used as fallback. */
+	zend_fiber_io io;
+
+	/* Timers of sleeping fibers and waits with a timeout. */
+	zend_fiber_timer_wheel timers;
+
+	/* Size of the io_uring submission queue, 0 disables io_uring (fiber.io_uring_entries). */
+	zend_long io_uring_entries;
+
+	/* Fiber-local storage of the main context, number of registered slots and their ZEND_FIBER_LOCAL_* flags. */
+	zend_fiber_locals locals;
+	uint32_t local_count;
+	zend_uchar *local_flags;
+
+	/* Suspend fibers in blocking socket operations and sleep functions (fiber.hook_blocking). */
+	zend_bool hook_blocking;
+
+	/* Number of worker threads running offloaded blocking calls, 0 runs them inline (fiber.thread_pool_size). */
+	zend_long thread_pool_size;
+
+	/* Tasks of this request that have been handed to the thread pool, created on first use. */
+	zend_fiber_tasks *tasks;
+
 ZEND_END_MODULE_GLOBALS(fiber)
 
 extern ZEND_DECLARE_MODULE_GLOBALS(fiber)
@@ -21,12 +21,19 @@
 
 #include "php_fiber.h"
 #include "fiber.h"
+#include "fiber_scheduler.h"
+#include "fiber_cancellation.h"
+#include "fiber_probes.h"
+
+#ifndef PHP_WIN32
+#include "fiber_stack.h"
+#endif
 
 #ifndef ZEND_PARSE_PARAMETERS_NONE
 #define ZEND_PARSE_PARAMETERS_NONE() zend_parse_parameters_none()
 #endif
 
-static zend_class_entry *zend_ce_fiber;
+zend_class_entry *zend_ce_fiber;
 static zend_object_handlers zend_fiber_handlers;
 
 static zend_object *zend_fiber_object_create(zend_class_entry *ce);
@@ -53,7 +60,188 @@ static zend_op fiber_run_op[2];
 } while (0)
 
 
-static zend_bool zend_fiber_switch_to(zend_fiber *fiber)
+uint64_t zend_fiber_clock()
+{
+#ifdef PHP_WIN32
+	static LARGE_INTEGER frequency;
+	LARGE_INTEGER counter;
+
+	if (frequency.QuadPart == 0) {
+		QueryPerformanceFrequency(&frequency);
+	}
+
+	QueryPerformanceCounter(&counter);
+
+	return (uint64_t) ((double) counter.QuadPart * 1000000000.0 / (double) frequency.QuadPart);
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec;
+#endif
+}
+
+
+static void zend_fiber_reclaim_idle(uint64_t now)
+{
+	zend_fiber *fiber;
+	uint64_t threshold;
+
+	if (now < FIBER_G(reclaim_at)) {
+		return;
+	}
+
+	threshold = (uint64_t) FIBER_G(stack_reclaim_threshold) * 1000000;
+	FIBER_G(reclaim_at) = now + threshold / 4;
+
+	while ((fiber = FIBER_G(idle_head)) != NULL && fiber->suspended_at + threshold <= now) {
+		FIBER_G(idle_head) = fiber->idle_next;
+
+		if (fiber->idle_next != NULL) {
+			fiber->idle_next->idle_prev = NULL;
+		} else {
+			FIBER_G(idle_tail) = NULL;
+		}
+
+		fiber->idle_next = NULL;
+		fiber->idle = 0;
+
+		zend_fiber_reclaim(fiber->context);
+	}
+
+#ifndef PHP_WIN32
+	zend_fiber_stack_pool_reclaim(now, threshold);
+#endif
+}
+
+
+static void zend_fiber_mark_idle(zend_fiber *fiber)
+{
+	uint64_t now;
+
+	if (FIBER_G(stack_reclaim_threshold) <= 0) {
+		return;
+	}
+
+	now = zend_fiber_clock();
+
+	zend_fiber_reclaim_idle(now);
+
+	fiber->suspended_at = now;
+	fiber->idle = 1;
+	fiber->idle_prev = FIBER_G(idle_tail);
+	fiber->idle_next = NULL;
+
+	if (FIBER_G(idle_tail) != NULL) {
+		FIBER_G(idle_tail)->idle_next = fiber;
+	} else {
+		FIBER_G(idle_head) = fiber;
+	}
+
+	FIBER_G(idle_tail) = fiber;
+}
+
+
+static void zend_fiber_unmark_idle(zend_fiber *fiber)
+{
+	if (!fiber->idle) {
+		return;
+	}
+
+	if (fiber->idle_prev != NULL) {
+		fiber->idle_prev->idle_next = fiber->idle_next;
+	} else {
+		FIBER_G(idle_head) = fiber->idle_next;
+	}
+
+	if (fiber->idle_next != NULL) {
+		fiber->idle_next->idle_prev = fiber->idle_prev;
+	} else {
+		FIBER_G(idle_tail) = fiber->idle_prev;
+	}
+
+	fiber->idle_prev = NULL;
+	fiber->idle_next = NULL;
+	fiber->idle = 0;
+}
+
+
+/* A run slice lasts from switching into a fiber until it switches away, fibers it runs directly end the slice. */
+static zend_always_inline void zend_fiber_slice_begin(zend_fiber *fiber)
+{
+	if (FIBER_G(profile)) {
+		fiber->slice_start = zend_fiber_clock();
+	}
+}
+
+
+static void zend_fiber_slice_end(zend_fiber *fiber)
+{
+	uint64_t length;
+	uint64_t micros;
+	int bucket;
+
+	if (!FIBER_G(profile) || fiber->slice_start == 0) {
+		return;
+	}
+
+	length = zend_fiber_clock() - fiber->slice_start;
+	fiber->slice_start = 0;
+
+	fiber->run_time += length;
+	fiber->slices++;
+
+	if (length > fiber->slice_max) {
+		fiber->slice_max = length;
+	}
+
+	micros = length / 1000;
+	bucket = 0;
+
+	while ((micros >> (bucket + 1)) && bucket < ZEND_FIBER_SLICE_BUCKETS - 1) {
+		bucket++;
+	}
+
+	FIBER_G(slice_histogram)[bucket]++;
+	FIBER_G(slice_samples)++;
+
+	if (length > FIBER_G(slice_peak)) {
+		FIBER_G(slice_peak) = length;
+	}
+}
+
+
+static zend_vm_stack zend_fiber_vm_stack_init(void *segment)
+{
+	zend_vm_stack stack;
+
+	stack = (zend_vm_stack) segment;
+	stack->top = ZEND_VM_STACK_ELEMENTS(stack) + 1;
+	stack->end = (zval *) ((char *) stack + FIBER_G(vm_stack_size));
+	stack->prev = NULL;
+
+	return stack;
+}
+
+
+static void zend_fiber_vm_stack_release(zend_vm_stack stack)
+{
+	zend_vm_stack prev;
+
+	/* The first segment is owned by the fiber context, only segments added by
+	 * zend_vm_stack_extend() are freed. */
+	while (stack->prev != NULL) {
+		prev = stack->prev;
+		efree(stack);
+		stack = prev;
+
+		FIBER_G(stats).vm_stack_segments_released++;
+	}
+}
+
+
+zend_bool zend_fiber_switch_to(zend_fiber *fiber)
 {
 	zend_fiber_context root;
 
@@ -70,6 +258,7 @@ static zend_bool zend_fiber_switch_to(zend_fiber *fiber)
 	}
 
 	zend_fiber *prev;
+	zend_fiber *released;
 	zend_bool result;
 	zend_execute_data *exec;
 	zend_vm_stack stack;
@@ -80,16 +269,109 @@ static zend_bool zend_fiber_switch_to(zend_fiber *fiber)
 	prev = FIBER_G(current_fiber);
 	FIBER_G(current_fiber) = fiber;
 
+	FIBER_G(stats).switches++;
+
+	if (prev != NULL) {
+		zend_fiber_slice_end(prev);
+	}
+
 	result = zend_fiber_switch_context((prev == NULL) ? root : prev->context, fiber->context);
 
 	FIBER_G(current_fiber) = prev;
 
+	if (prev != NULL) {
+		zend_fiber_slice_begin(prev);
+	}
+
 	ZEND_FIBER_RESTORE_EG(stack, stack_page_size, exec);
 
+	/* A fiber finishing or suspending itself returns to its caller, which drops the reference held by the scheduler. */
+	released = FIBER_G(released);
+
+	if (released != NULL) {
+		FIBER_G(released) = NULL;
+		OBJ_RELEASE(&released->std);
+	}
+
 	return result;
 }
 
 
+/* Switches away from the running fiber, either back to its caller or directly to next. Returns
+ * once the fiber is resumed, 0 is returned if an exception has been thrown into the fiber. */
+static zend_bool zend_fiber_leave(zend_fiber *fiber, zend_fiber *next)
+{
+	zend_execute_data *exec;
+	size_t stack_page_size;
+	zend_bool result;
+	zval *error;
+
+	zend_fiber_mark_idle(fiber);
+
+	ZEND_FIBER_BACKUP_EG(fiber->stack, stack_page_size, fiber->exec);
+
+	FIBER_G(stats).switches++;
+	FIBER_G(stats).suspended++;
+
+	zend_fiber_slice_end(fiber);
+
+	ZEND_FIBER_PROBE(suspend, fiber);
+
+	if (next == NULL) {
+		result = zend_fiber_suspend(fiber->context);
+	} else {
+		FIBER_G(current_fiber) = next;
+
+		result = zend_fiber_transfer_context(fiber->context, next->context);
+
+		if (UNEXPECTED(!result)) {
+			FIBER_G(current_fiber) = fiber;
+		}
+	}
+
+	ZEND_FIBER_RESTORE_EG(fiber->stack, stack_page_size, fiber->exec);
+
+	FIBER_G(stats).suspended--;
+
+	ZEND_FIBER_PROBE(resume, fiber);
+
+	zend_fiber_slice_begin(fiber);
+
+	zend_fiber_unmark_idle(fiber);
+
+	/* Resumed directly, not by the scheduler or wait queue it has been linked into. */
+	zend_fiber_queue_remove(fiber);
+
+	if (UNEXPECTED(!result)) {
+		fiber->status = ZEND_FIBER_STATUS_RUNNING;
+		zend_throw_error(NULL, "Failed switching to fiber");
+		return 0;
+	}
+
+	if (fiber->status == ZEND_FIBER_STATUS_DEAD) {
+		zend_throw_error(NULL, "Fiber has been destroyed");
+		return 0;
+	}
+
+	error = FIBER_G(error);
+
+	if (error != NULL) {
+		FIBER_G(error) = NULL;
+		exec = EG(current_execute_data);
+
+		ZEND_FIBER_PROBE(throw, fiber);
+
+		exec->opline--;
+		zend_throw_exception_object(error);
+		exec->opline++;
+
+		return 0;
+	}
+
+	return 1;
+}
+
+
 static void zend_fiber_run()
 {
 	zend_fiber *fiber;
@@ -100,7 +382,7 @@ static void zend_fiber_run()
 	EG(vm_stack) = fiber->stack;
 	EG(vm_stack_top) = fiber->stack->top;
 	EG(vm_stack_end) = fiber->stack->end;
-	EG(vm_stack_page_size) = ZEND_FIBER_VM_STACK_SIZE;
+	EG(vm_stack_page_size) = (size_t) FIBER_G(vm_stack_size);
 
 	fiber->exec = (zend_execute_data *) EG(vm_stack_top);
 	EG(vm_stack_top) = (zval *) fiber->exec + ZEND_CALL_FRAME_SLOT;
@@ -112,16 +394,31 @@ static void zend_fiber_run()
 
 	EG(current_execute_data) = fiber->exec;
 
+	ZEND_FIBER_PROBE(start, fiber);
+
+	zend_fiber_slice_begin(fiber);
+
 	execute_ex(fiber->exec);
 
+	zend_fiber_slice_end(fiber);
+
+	ZEND_FIBER_PROBE(finish, fiber);
+
 	fiber->value = NULL;
 
 	zval_ptr_dtor(&fiber->fci.function_name);
 
-	zend_vm_stack_destroy();
+	zend_fiber_vm_stack_release(EG(vm_stack));
 	fiber->stack = NULL;
 	fiber->exec = NULL;
 
+	if (fiber->attached) {
+		fiber->attached = 0;
+		FIBER_G(released) = fiber;
+	}
+
+	FIBER_G(stats).switches++;
+
 	zend_fiber_suspend(fiber->context);
 
 	abort();
@@ -139,9 +436,17 @@ static int fiber_run_opcode_handler(zend_execute_data *exec)
 	fiber->status = ZEND_FIBER_STATUS_RUNNING;
 	fiber->fci.retval = &retval;
 
+	ZVAL_UNDEF(&retval);
+
 	if (zend_call_function(&fiber->fci, &fiber->fci_cache) == SUCCESS) {
-		if (fiber->value != NULL && !EG(exception)) {
-			ZVAL_ZVAL(fiber->value, &retval, 0, 1);
+		if (!EG(exception)) {
+			ZVAL_COPY_VALUE(&fiber->retval, &retval);
+
+			if (fiber->value != NULL) {
+				ZVAL_COPY(fiber->value, &retval);
+			}
+		} else {
+			zval_ptr_dtor(&retval);
 		}
 	}
 
@@ -151,14 +456,136 @@ static int fiber_run_opcode_handler(zend_execute_data *exec)
 		} else {
 			fiber->status = ZEND_FIBER_STATUS_DEAD;
 		}
+
+		FIBER_G(stats).dead++;
 	} else {
 		fiber->status = ZEND_FIBER_STATUS_FINISHED;
+
+		FIBER_G(stats).finished++;
 	}
 
+	zend_fiber_notify_awaiters(fiber);
+
 	return ZEND_USER_OPCODE_RETURN;
 }
 
 
+static zend_bool zend_fiber_prepare(zend_fiber *fiber, zval *params, uint32_t param_count)
+{
+	void *segment;
+
+	zend_fiber_queue_remove(fiber);
+
+	/* Fibers started within another fiber are cancelled along with it. */
+	if (FIBER_G(current_fiber) != NULL) {
+		zend_fiber_cancellation_inherit(fiber, FIBER_G(current_fiber));
+	}
+
+	zend_fiber_locals_inherit(&fiber->locals);
+
+	fiber->fci.params = params;
+	fiber->fci.param_count = param_count;
+#if PHP_VERSION_ID < 80000
+	fiber->fci.no_separation = 1;
+#endif
+
+	fiber->context = zend_fiber_create(zend_fiber_run, fiber->stack_size, (size_t) FIBER_G(vm_stack_size), &segment);
+
+	if (fiber->context == NULL) {
+		FIBER_G(stats).create_failures++;
+
+		zend_throw_error(NULL, "Failed to create native fiber");
+		return 0;
+	}
+
+	FIBER_G(stats).created++;
+
+	ZEND_FIBER_PROBE(create, fiber);
+
+	fiber->stack = zend_fiber_vm_stack_init(segment);
+
+	return 1;
+}
+
+
+zend_bool zend_fiber_start(zend_fiber *fiber, zval *params, uint32_t param_count, zval *return_value)
+{
+	if (!zend_fiber_prepare(fiber, params, param_count)) {
+		return 0;
+	}
+
+	fiber->value = return_value;
+
+	if (!zend_fiber_switch_to(fiber)) {
+		zend_throw_error(NULL, "Failed switching to fiber");
+		return 0;
+	}
+
+	return 1;
+}
+
+
+zend_bool zend_fiber_resume(zend_fiber *fiber, zval *value, zval *return_value)
+{
+	zend_fiber_queue_remove(fiber);
+
+	if (value != NULL && fiber->value != NULL) {
+		ZVAL_COPY(fiber->value, value);
+		fiber->value = NULL;
+	}
+
+	fiber->status = ZEND_FIBER_STATUS_RUNNING;
+	fiber->value = return_value;
+
+	if (!zend_fiber_switch_to(fiber)) {
+		zend_throw_error(NULL, "Failed switching to fiber");
+		return 0;
+	}
+
+	return 1;
+}
+
+
+zend_bool zend_fiber_pause(zend_fiber *fiber, zval *value, zval *return_value)
+{
+	if (value != NULL && fiber->value != NULL) {
+		ZVAL_COPY(fiber->value, value);
+		fiber->value = NULL;
+	}
+
+	fiber->status = ZEND_FIBER_STATUS_SUSPENDED;
+	fiber->value = return_value;
+
+	return zend_fiber_leave(fiber, NULL);
+}
+
+
+zend_bool zend_fiber_transfer(zend_fiber *fiber, zend_fiber *next, zval *value, zval *return_value)
+{
+	if (next->status == ZEND_FIBER_STATUS_INIT) {
+		if (!zend_fiber_prepare(next, value, (value != NULL) ? 1 : 0)) {
+			return 0;
+		}
+	} else {
+		zend_fiber_queue_remove(next);
+
+		if (value != NULL && next->value != NULL) {
+			ZVAL_COPY(next->value, value);
+		}
+
+		next->status = ZEND_FIBER_STATUS_RUNNING;
+	}
+
+	/* Whatever next suspends with goes to the caller of the running fiber. */
+	next->value = fiber->value;
+
+	fiber->status = ZEND_FIBER_STATUS_SUSPENDED;
+	fiber->value = return_value;
+
+	return zend_fiber_leave(fiber, next);
+}
+
+
 static zend_object *zend_fiber_object_create(zend_class_entry *ce)
 {
 	zend_fiber *fiber;
@@ -173,56 +600,558 @@ static zend_object *zend_fiber_object_create(zend_class_entry *ce)
 }
 
 
-static void zend_fiber_object_destroy(zend_object *object)
+static zend_always_inline void zend_fiber_gc_add(zend_fiber *fiber, uint32_t *count, zval *zv)
+{
+	if (!Z_REFCOUNTED_P(zv)) {
+		return;
+	}
+
+	if (*count == fiber->gc_size) {
+		fiber->gc_size = (fiber->gc_size == 0) ? 16 : fiber->gc_size * 2;
+		fiber->gc_buffer = safe_erealloc(fiber->gc_buffer, fiber->gc_size, sizeof(zval), 0);
+	}
+
+	ZVAL_COPY_VALUE(&fiber->gc_buffer[(*count)++], zv);
+}
+
+
+/* Collects arguments already sent to calls the frame has started to build around the call the fiber has been
+ * suspended in, e.g. foo($a, Fiber::suspend()). Follows zend_unfinished_calls_gc() of the engine. */
+static void zend_fiber_gc_calls(zend_fiber *fiber, uint32_t *count, zend_execute_data *ex, uint32_t op_num)
+{
+	zend_execute_data *call;
+	const zend_op *opline;
+	uint32_t num_args;
+	uint32_t i;
+	int level;
+	zend_bool done;
+	zval tmp;
+
+	/* The opline is the DO_*CALL being executed, it is balanced by the INIT_* of the same call. */
+	opline = ex->func->op_array.opcodes + op_num;
+
+	for (call = ex->call; call != NULL; call = call->prev_execute_data) {
+		/* Find the number of arguments that have actually been sent. */
+		level = 0;
+		done = 0;
+		num_args = ZEND_CALL_NUM_ARGS(call);
+
+		do {
+			switch (opline->opcode) {
+				case ZEND_DO_FCALL:
+				case ZEND_DO_ICALL:
+				case ZEND_DO_UCALL:
+				case ZEND_DO_FCALL_BY_NAME:
+					level++;
+					break;
+				case ZEND_INIT_FCALL:
+				case ZEND_INIT_FCALL_BY_NAME:
+				case ZEND_INIT_NS_FCALL_BY_NAME:
+				case ZEND_INIT_DYNAMIC_CALL:
+				case ZEND_INIT_USER_CALL:
+				case ZEND_INIT_METHOD_CALL:
+				case ZEND_INIT_STATIC_METHOD_CALL:
+				case ZEND_NEW:
+					if (level == 0) {
+						num_args = 0;
+						done = 1;
+					}
+					level--;
+					break;
+				case ZEND_SEND_VAL:
+				case ZEND_SEND_VAL_EX:
+				case ZEND_SEND_VAR:
+				case ZEND_SEND_VAR_EX:
+				case ZEND_SEND_FUNC_ARG:
+				case ZEND_SEND_REF:
+				case ZEND_SEND_VAR_NO_REF:
+				case ZEND_SEND_VAR_NO_REF_EX:
+				case ZEND_SEND_USER:
+					if (level == 0) {
+#if PHP_VERSION_ID >= 80000
+						/* The number of named arguments is up to date. */
+						if (opline->op2_type != IS_CONST) {
+							num_args = opline->op2.num;
+						}
+#else
+						num_args = opline->op2.num;
+#endif
+						done = 1;
+					}
+					break;
+				case ZEND_SEND_ARRAY:
+				case ZEND_SEND_UNPACK:
+#if PHP_VERSION_ID >= 80000
+				case ZEND_CHECK_UNDEF_ARGS:
+#endif
+					if (level == 0) {
+						done = 1;
+					}
+					break;
+			}
+
+			if (!done) {
+				opline--;
+			}
+		} while (!done);
+
+		/* Skip the rest of this call to reach the sends of the enclosing one. */
+		if (call->prev_execute_data != NULL) {
+			level = 0;
+			done = 0;
+
+			do {
+				switch (opline->opcode) {
+					case ZEND_DO_FCALL:
+					case ZEND_DO_ICALL:
+					case ZEND_DO_UCALL:
+					case ZEND_DO_FCALL_BY_NAME:
+						level++;
+						break;
+					case ZEND_INIT_FCALL:
+					case ZEND_INIT_FCALL_BY_NAME:
+					case ZEND_INIT_NS_FCALL_BY_NAME:
+					case ZEND_INIT_DYNAMIC_CALL:
+					case ZEND_INIT_USER_CALL:
+					case ZEND_INIT_METHOD_CALL:
+					case ZEND_INIT_STATIC_METHOD_CALL:
+					case ZEND_NEW:
+						if (level == 0) {
+							done = 1;
+						}
+						level--;
+						break;
+				}
+
+				opline--;
+			} while (!done);
+		}
+
+		for (i = 1; i <= num_args; i++) {
+			zend_fiber_gc_add(fiber, count, ZEND_CALL_ARG(call, i));
+		}
+
+		if (ZEND_CALL_INFO(call) & ZEND_CALL_RELEASE_THIS) {
+			ZVAL_OBJ(&tmp, Z_OBJ(call->This));
+			zend_fiber_gc_add(fiber, count, &tmp);
+		}
+
+		if (ZEND_CALL_INFO(call) & ZEND_CALL_CLOSURE) {
+			ZVAL_OBJ(&tmp, ZEND_CLOSURE_OBJECT(call->func));
+			zend_fiber_gc_add(fiber, count, &tmp);
+		}
+	}
+}
+
+
+/* Collects values referenced by a frame of a suspended fiber, like the engine does for suspended generators. */
+static void zend_fiber_gc_frame(zend_fiber *fiber, uint32_t *count, zend_execute_data *ex)
+{
+	zend_op_array *op_array;
+	zend_live_range *range;
+	uint32_t num_args;
+	uint32_t op_num;
+	uint32_t kind;
+	uint32_t i;
+	zval tmp;
+
+	/* Frames pushed by zend_call_function() do not own This, it is held by the callable. The call info bits are
+	 * stored in the type info of This, the object is reported through a clean zval. */
+	if (ZEND_CALL_INFO(ex) & ZEND_CALL_RELEASE_THIS) {
+		ZVAL_OBJ(&tmp, Z_OBJ(ex->This));
+		zend_fiber_gc_add(fiber, count, &tmp);
+	}
+
+	if (ZEND_CALL_INFO(ex) & ZEND_CALL_CLOSURE) {
+		ZVAL_OBJ(&tmp, ZEND_CLOSURE_OBJECT(ex->func));
+		zend_fiber_gc_add(fiber, count, &tmp);
+	}
+
+	num_args = ZEND_CALL_NUM_ARGS(ex);
+
+	if (!ZEND_USER_CODE(ex->func->type)) {
+		for (i = 1; i <= num_args; i++) {
+			zend_fiber_gc_add(fiber, count, ZEND_CALL_ARG(ex, i));
+		}
+
+		return;
+	}
+
+	op_array = &ex->func->op_array;
+
+	/* Variables of frames with a symbol table may be shared with other frames (include), they are skipped. */
+	if (!(ZEND_CALL_INFO(ex) & ZEND_CALL_HAS_SYMBOL_TABLE)) {
+		for (i = 0; i < (uint32_t) op_array->last_var; i++) {
+			zend_fiber_gc_add(fiber, count, ZEND_CALL_VAR_NUM(ex, i));
+		}
+	}
+
+	if ((ZEND_CALL_INFO(ex) & ZEND_CALL_FREE_EXTRA_ARGS) && num_args > op_array->num_args) {
+		for (i = 0; i < num_args - op_array->num_args; i++) {
+			zend_fiber_gc_add(fiber, count, ZEND_CALL_VAR_NUM(ex, op_array->last_var + op_array->T + i));
+		}
+	}
+
+	if (ex->opline == NULL) {
+		return;
+	}
+
+	/* Temporaries live across the call the fiber has been suspended in. */
+	op_num = (uint32_t) (ex->opline - op_array->opcodes);
+
+	if (ex->call != NULL) {
+		zend_fiber_gc_calls(fiber, count, ex, op_num);
+	}
+
+	for (i = 0; i < (uint32_t) op_array->last_live_range; i++) {
+		range = &op_array->live_range[i];
+
+		if (range->start > op_num) {
+			break;
+		}
+
+		if (op_num >= range->end) {
+			continue;
+		}
+
+		kind = range->var & ZEND_LIVE_MASK;
+
+#ifdef ZEND_LIVE_NEW
+		if (kind == ZEND_LIVE_TMPVAR || kind == ZEND_LIVE_LOOP || kind == ZEND_LIVE_NEW) {
+#else
+		if (kind == ZEND_LIVE_TMPVAR || kind == ZEND_LIVE_LOOP) {
+#endif
+			zend_fiber_gc_add(fiber, count, ZEND_CALL_VAR(ex, range->var & ~ZEND_LIVE_MASK));
+		}
+	}
+}
+
+
+#if PHP_VERSION_ID >= 80000
+static HashTable *zend_fiber_object_gc(zend_object *object, zval **table, int *n)
+#else
+static HashTable *zend_fiber_object_gc(zval *object, zval **table, int *n)
+#endif
 {
 	zend_fiber *fiber;
+	zend_execute_data *ex;
+	uint32_t count;
+	uint32_t i;
 
+#if PHP_VERSION_ID >= 80000
 	fiber = (zend_fiber *) object;
+#else
+	fiber = (zend_fiber *) Z_OBJ_P(object);
+#endif
+
+	count = 0;
+
+	/* The callback is released once the fiber has finished, along with its VM stack. */
+	if (fiber->status == ZEND_FIBER_STATUS_INIT || fiber->stack != NULL) {
+		zend_fiber_gc_add(fiber, &count, &fiber->fci.function_name);
+	}
+
+	zend_fiber_gc_add(fiber, &count, &fiber->send);
+	zend_fiber_gc_add(fiber, &count, &fiber->retval);
+
+	for (i = 0; i < fiber->locals.size; i++) {
+		zend_fiber_gc_add(fiber, &count, &fiber->locals.slots[i]);
+	}
+
+	count = zend_fiber_queue_gc(&fiber->awaiters, &fiber->gc_buffer, &fiber->gc_size, count);
+
+	/* Frames of a running fiber are part of the active call stack and are not traversed. */
+	if (fiber->status == ZEND_FIBER_STATUS_SUSPENDED && fiber->exec != NULL) {
+		for (ex = fiber->exec; ex != NULL; ex = ex->prev_execute_data) {
+			/* Dummy frames pushed by zend_call_function() have no function. */
+			if (ex->func != NULL) {
+				zend_fiber_gc_frame(fiber, &count, ex);
+			}
+		}
+	}
+
+	*table = fiber->gc_buffer;
+	*n = (int) count;
+
+	return zend_std_get_properties(object);
+}
+
+
+/* Detaches the fiber and unwinds it if it is suspended, running its finally blocks. */
+static void zend_fiber_object_unwind(zend_fiber *fiber)
+{
+	/* Happens on shutdown or once the collector found a parked fiber to be garbage, the scheduler reference must not
+	 * be released again. */
+	fiber->attached = 0;
+
+	zend_fiber_queue_remove(fiber);
+	zend_fiber_timer_stop(&fiber->timer);
+
+	while (zend_fiber_queue_shift(&fiber->awaiters) != NULL);
 
 	if (fiber->status == ZEND_FIBER_STATUS_SUSPENDED) {
 		fiber->status = ZEND_FIBER_STATUS_DEAD;
 
 		zend_fiber_switch_to(fiber);
 	}
+}
+
+
+/* Suspended fibers found in garbage cycles are unwound here, user code must not run in free_obj. */
+static void zend_fiber_object_dtor(zend_object *object)
+{
+	zend_objects_destroy_object(object);
+
+	zend_fiber_object_unwind((zend_fiber *) object);
+}
+
+
+static void zend_fiber_object_destroy(zend_object *object)
+{
+	zend_fiber *fiber;
+
+	fiber = (zend_fiber *) object;
+
+	zend_fiber_object_unwind(fiber);
 
 	if (fiber->status == ZEND_FIBER_STATUS_INIT) {
 		zval_ptr_dtor(&fiber->fci.function_name);
 	}
 
+	zval_ptr_dtor(&fiber->send);
+	zval_ptr_dtor(&fiber->retval);
+
+	zend_fiber_cancellation_release(fiber);
+	zend_fiber_locals_destroy(&fiber->locals);
+
+	if (fiber->gc_buffer != NULL) {
+		efree(fiber->gc_buffer);
+	}
+
+	ZEND_FIBER_PROBE(destroy, fiber);
+
 	zend_fiber_destroy(fiber->context);
 
 	zend_object_std_dtor(&fiber->std);
 }
 
 
-/* {{{ proto Fiber::__construct(callable $callback) */
+/* {{{ proto Fiber::__construct(callable $callback, int $stack_size = 0) */
 ZEND_METHOD(Fiber, __construct)
 {
 	zend_fiber *fiber;
+	zend_long stack_size;
 
 	fiber = (zend_fiber *) Z_OBJ_P(getThis());
+	stack_size = 0;
+
+	ZEND_PARSE_PARAMETERS_START_EX(ZEND_PARSE_PARAMS_THROW, 1, 2)
+		Z_PARAM_FUNC_EX(fiber->fci, fiber->fci_cache, 1, 0)
+		Z_PARAM_OPTIONAL
+		Z_PARAM_LONG(stack_size)
+	ZEND_PARSE_PARAMETERS_END();
+
+	fiber->status = ZEND_FIBER_STATUS_INIT;
+
+	// Keep a reference to closures or callable objects as long as the fiber lives.
+	Z_TRY_ADDREF_P(&fiber->fci.function_name);
+
+	if (stack_size == 0) {
+		stack_size = FIBER_G(stack_size);
+
+		if (stack_size == 0) {
+			stack_size = ZEND_FIBER_DEFAULT_STACK_SIZE;
+		}
+	} else if (stack_size < ZEND_FIBER_MIN_STACK_SIZE) {
+		zend_throw_error(NULL, "Fiber stack size must be at least %d bytes", ZEND_FIBER_MIN_STACK_SIZE);
+		return;
+	}
+
+	fiber->stack_size = (size_t) stack_size;
+}
+/* }}} */
+
+
+/* {{{ proto int Fiber::status() */
+ZEND_METHOD(Fiber, status)
+{
+	ZEND_PARSE_PARAMETERS_NONE();
+
+	zend_fiber *fiber = (zend_fiber *) Z_OBJ_P(getThis());
+
+	RETURN_LONG(fiber->status);
+}
+/* }}} */
+
+
+/* {{{ proto bool Fiber::isRunning() */
+ZEND_METHOD(Fiber, isRunning)
+{
+	ZEND_PARSE_PARAMETERS_NONE();
+
+	RETURN_BOOL(((zend_fiber *) Z_OBJ_P(getThis()))->status == ZEND_FIBER_STATUS_RUNNING);
+}
+/* }}} */
+
+
+/* {{{ proto bool Fiber::isSuspended() */
+ZEND_METHOD(Fiber, isSuspended)
+{
+	ZEND_PARSE_PARAMETERS_NONE();
+
+	RETURN_BOOL(((zend_fiber *) Z_OBJ_P(getThis()))->status == ZEND_FIBER_STATUS_SUSPENDED);
+}
+/* }}} */
+
+
+/* {{{ proto bool Fiber::isTerminated() */
+ZEND_METHOD(Fiber, isTerminated)
+{
+	zend_fiber *fiber;
+
+	ZEND_PARSE_PARAMETERS_NONE();
+
+	fiber = (zend_fiber *) Z_OBJ_P(getThis());
+
+	RETURN_BOOL(fiber->status == ZEND_FIBER_STATUS_FINISHED || fiber->status == ZEND_FIBER_STATUS_DEAD);
+}
+/* }}} */
+
+
+/* {{{ proto mixed Fiber::getReturn() */
+ZEND_METHOD(Fiber, getReturn)
+{
+	zend_fiber *fiber;
+
+	ZEND_PARSE_PARAMETERS_NONE();
+
+	fiber = (zend_fiber *) Z_OBJ_P(getThis());
+
+	if (fiber->status == ZEND_FIBER_STATUS_FINISHED) {
+		RETURN_ZVAL(&fiber->retval, 1, 0);
+	}
+
+	if (fiber->status == ZEND_FIBER_STATUS_DEAD) {
+		zend_throw_error(NULL, "Cannot get the return value of a fiber that threw an exception or has been destroyed");
+	} else {
+		zend_throw_error(NULL, "Cannot get the return value of a fiber that has not finished");
+	}
+}
+/* }}} */
+
+
+/* {{{ proto ?Fiber Fiber::getCurrent() */
+ZEND_METHOD(Fiber, getCurrent)
+{
+	zend_fiber *fiber;
+
+	ZEND_PARSE_PARAMETERS_NONE();
+
+	fiber = FIBER_G(current_fiber);
+
+	if (fiber == NULL) {
+		RETURN_NULL();
+	}
+
+	GC_ADDREF(&fiber->std);
+
+	RETURN_OBJ(&fiber->std);
+}
+/* }}} */
+
+
+/* {{{ proto ?int Fiber::getStackUsage() */
+ZEND_METHOD(Fiber, getStackUsage)
+{
+	zend_fiber *fiber;
+	size_t usage;
+
+	ZEND_PARSE_PARAMETERS_NONE();
+
+	fiber = (zend_fiber *) Z_OBJ_P(getThis());
+	usage = zend_fiber_stack_usage(fiber->context);
+
+	if (usage == 0) {
+		RETURN_NULL();
+	}
+
+	RETURN_LONG((zend_long) usage);
+}
+/* }}} */
+
+
+/* {{{ proto ?array Fiber::getProfile() */
+ZEND_METHOD(Fiber, getProfile)
+{
+	zend_fiber *fiber;
+	uint64_t run_time;
+
+	ZEND_PARSE_PARAMETERS_NONE();
+
+	if (!FIBER_G(profile)) {
+		RETURN_NULL();
+	}
+
+	fiber = (zend_fiber *) Z_OBJ_P(getThis());
+	run_time = fiber->run_time;
+
+	/* The slice of a running fiber is still open. */
+	if (fiber->slice_start != 0) {
+		run_time += zend_fiber_clock() - fiber->slice_start;
+	}
+
+	array_init(return_value);
+
+	add_assoc_double(return_value, "run_time", (double) run_time / 1.0e9);
+	add_assoc_long(return_value, "slices", (zend_long) fiber->slices);
+	add_assoc_double(return_value, "slice_max", (double) fiber->slice_max / 1.0e9);
+}
+/* }}} */
+
+
+/* {{{ proto array Fiber::getSliceHistogram() */
+ZEND_METHOD(Fiber, getSliceHistogram)
+{
+	zend_ulong *histogram;
+	int i;
+
+	ZEND_PARSE_PARAMETERS_NONE();
 
-	ZEND_PARSE_PARAMETERS_START_EX(ZEND_PARSE_PARAMS_THROW, 1, 1)
-		Z_PARAM_FUNC_EX(fiber->fci, fiber->fci_cache, 1, 0)
-	ZEND_PARSE_PARAMETERS_END();
+	histogram = FIBER_G(slice_histogram);
 
-	fiber->status = ZEND_FIBER_STATUS_INIT;
-	fiber->stack_size = ZEND_FIBER_VM_STACK_SIZE * (((sizeof(void *)) < 8) ? 16 : 128);
+	array_init(return_value);
 
-	// Keep a reference to closures or callable objects as long as the fiber lives.
-	Z_TRY_ADDREF_P(&fiber->fci.function_name);
+	/* Keyed by bucket index, 2^(n + 1) would not fit into zend_ulong on 32-bit builds. */
+	for (i = 0; i < ZEND_FIBER_SLICE_BUCKETS; i++) {
+		if (histogram[i] > 0) {
+			add_index_long(return_value, i, (zend_long) histogram[i]);
+		}
+	}
 }
 /* }}} */
 
 
-/* {{{ proto int Fiber::status() */
-ZEND_METHOD(Fiber, status)
+/* {{{ proto array Fiber::getStats() */
+ZEND_METHOD(Fiber, getStats)
 {
+	zend_fiber_stats *stats;
+
 	ZEND_PARSE_PARAMETERS_NONE();
 
-	zend_fiber *fiber = (zend_fiber *) Z_OBJ_P(getThis());
+	stats = &FIBER_G(stats);
 
-	RETURN_LONG(fiber->status);
+	array_init(return_value);
+
+	add_assoc_long(return_value, "created", (zend_long) stats->created);
+	add_assoc_long(return_value, "finished", (zend_long) stats->finished);
+	add_assoc_long(return_value, "dead", (zend_long) stats->dead);
+	add_assoc_long(return_value, "suspended", (zend_long) stats->suspended);
+	add_assoc_long(return_value, "switches", (zend_long) stats->switches);
+	add_assoc_long(return_value, "stack_mapped", (zend_long) stats->stack_mapped);
+	add_assoc_long(return_value, "stacks_reused", (zend_long) FIBER_G(stack_pool_hits));
+	add_assoc_long(return_value, "stacks_allocated", (zend_long) FIBER_G(stack_pool_misses));
+	add_assoc_long(return_value, "vm_stack_segments_released", (zend_long) stats->vm_stack_segments_released);
+	add_assoc_long(return_value, "create_failures", (zend_long) stats->create_failures);
 }
 /* }}} */
 
@@ -245,34 +1174,7 @@ ZEND_METHOD(Fiber, start)
 		return;
 	}
 
-	fiber->fci.params = params;
-	fiber->fci.param_count = param_count;
-#if PHP_VERSION_ID < 80000
-	fiber->fci.no_separation = 1;
-#endif
-
-	fiber->context = zend_fiber_create_context();
-
-	if (fiber->context == NULL) {
-		zend_throw_error(NULL, "Failed to create native fiber context");
-		return;
-	}
-
-	if (!zend_fiber_create(fiber->context, zend_fiber_run, fiber->stack_size)) {
-		zend_throw_error(NULL, "Failed to create native fiber");
-		return;
-	}
-
-	fiber->stack = (zend_vm_stack) emalloc(ZEND_FIBER_VM_STACK_SIZE);
-	fiber->stack->top = ZEND_VM_STACK_ELEMENTS(fiber->stack) + 1;
-	fiber->stack->end = (zval *) ((char *) fiber->stack + ZEND_FIBER_VM_STACK_SIZE);
-	fiber->stack->prev = NULL;
-
-	fiber->value = USED_RET() ? return_value : NULL;
-
-	if (!zend_fiber_switch_to(fiber)) {
-		zend_throw_error(NULL, "Failed switching to fiber");
-	}
+	zend_fiber_start(fiber, params, param_count, USED_RET() ? return_value : NULL);
 }
 /* }}} */
 
@@ -297,17 +1199,78 @@ ZEND_METHOD(Fiber, resume)
 		return;
 	}
 
-	if (val != NULL && fiber->value != NULL) {
-		ZVAL_COPY(fiber->value, val);
-		fiber->value = NULL;
-	}
+	zend_fiber_resume(fiber, val, USED_RET() ? return_value : NULL);
+}
+/* }}} */
 
-	fiber->status = ZEND_FIBER_STATUS_RUNNING;
-	fiber->value = USED_RET() ? return_value : NULL;
 
-	if (!zend_fiber_switch_to(fiber)) {
-		zend_throw_error(NULL, "Failed switching to fiber");
-	}
+/* {{{ proto array Fiber::resumeAll(array $fibers [, array $values]) */
+ZEND_METHOD(Fiber, resumeAll)
+{
+	zend_fiber *fiber;
+	zend_string *key;
+	zend_ulong index;
+	HashTable *fibers;
+	HashTable *values;
+	zval *entry;
+	zval *val;
+	zval result;
+
+	values = NULL;
+
+	ZEND_PARSE_PARAMETERS_START_EX(ZEND_PARSE_PARAMS_THROW, 1, 2)
+		Z_PARAM_ARRAY_HT(fibers)
+		Z_PARAM_OPTIONAL
+		Z_PARAM_ARRAY_HT(values)
+	ZEND_PARSE_PARAMETERS_END();
+
+	ZEND_HASH_FOREACH_VAL(fibers, entry) {
+		ZVAL_DEREF(entry);
+
+		if (Z_TYPE_P(entry) != IS_OBJECT || Z_OBJCE_P(entry) != zend_ce_fiber) {
+			zend_throw_error(NULL, "Only Fiber objects can be resumed, %s given", zend_zval_type_name(entry));
+			return;
+		}
+	} ZEND_HASH_FOREACH_END();
+
+	array_init_size(return_value, zend_hash_num_elements(fibers));
+
+	/* Results are keyed like the fibers, each fiber receives the value with the same key. */
+	ZEND_HASH_FOREACH_KEY_VAL(fibers, index, key, entry) {
+		fiber = (zend_fiber *) Z_OBJ_P(Z_ISREF_P(entry) ? Z_REFVAL_P(entry) : entry);
+		val = NULL;
+
+		if (values != NULL) {
+			val = (key != NULL) ? zend_hash_find(values, key) : zend_hash_index_find(values, index);
+
+			if (val != NULL) {
+				ZVAL_DEREF(val);
+			}
+		}
+
+		ZVAL_NULL(&result);
+
+		if (fiber->status == ZEND_FIBER_STATUS_INIT) {
+			zend_fiber_start(fiber, val, (val != NULL) ? 1 : 0, &result);
+		} else if (fiber->status == ZEND_FIBER_STATUS_SUSPENDED) {
+			zend_fiber_resume(fiber, val, &result);
+		} else {
+			zend_throw_error(NULL, "Only fibers that are not running and have not terminated can be resumed");
+		}
+
+		if (UNEXPECTED(EG(exception))) {
+			zval_ptr_dtor(&result);
+			zval_ptr_dtor(return_value);
+			ZVAL_NULL(return_value);
+			return;
+		}
+
+		if (key != NULL) {
+			zend_hash_add_new(Z_ARRVAL_P(return_value), key, &result);
+		} else {
+			zend_hash_index_add_new(Z_ARRVAL_P(return_value), index, &result);
+		}
+	} ZEND_HASH_FOREACH_END();
 }
 /* }}} */
 
@@ -333,12 +1296,7 @@ ZEND_METHOD(Fiber, throw)
 
 	FIBER_G(error) = exception;
 
-	fiber->status = ZEND_FIBER_STATUS_RUNNING;
-	fiber->value = USED_RET() ? return_value : NULL;
-
-	if (!zend_fiber_switch_to(fiber)) {
-		zend_throw_error(NULL, "Failed switching to fiber");
-	}
+	zend_fiber_resume(fiber, NULL, USED_RET() ? return_value : NULL);
 }
 /* }}} */
 
@@ -347,10 +1305,7 @@ ZEND_METHOD(Fiber, throw)
 ZEND_METHOD(Fiber, suspend)
 {
 	zend_fiber *fiber;
-	zend_execute_data *exec;
-	size_t stack_page_size;
 	zval *val;
-	zval *error;
 
 	fiber = FIBER_G(current_fiber);
 
@@ -371,35 +1326,220 @@ ZEND_METHOD(Fiber, suspend)
 		Z_PARAM_ZVAL(val);
 	ZEND_PARSE_PARAMETERS_END();
 
-	if (val != NULL && fiber->value != NULL) {
-		ZVAL_COPY(fiber->value, val);
-		fiber->value = NULL;
+	/* Nothing wakes the fiber up anymore, it is kept alive by whoever resumes it. */
+	if (fiber->attached) {
+		fiber->attached = 0;
+		FIBER_G(released) = fiber;
 	}
 
-	fiber->status = ZEND_FIBER_STATUS_SUSPENDED;
-	fiber->value = USED_RET() ? return_value : NULL;
+	zend_fiber_pause(fiber, val, USED_RET() ? return_value : NULL);
+}
+/* }}} */
 
-	ZEND_FIBER_BACKUP_EG(fiber->stack, stack_page_size, fiber->exec);
 
-	zend_fiber_suspend(fiber->context);
+/* {{{ proto void Fiber::yield() */
+ZEND_METHOD(Fiber, yield)
+{
+	zend_fiber *fiber;
 
-	ZEND_FIBER_RESTORE_EG(fiber->stack, stack_page_size, fiber->exec);
+	ZEND_PARSE_PARAMETERS_NONE();
 
-	if (fiber->status == ZEND_FIBER_STATUS_DEAD) {
-		zend_throw_error(NULL, "Fiber has been destroyed");
+	fiber = FIBER_G(current_fiber);
+
+	if (UNEXPECTED(fiber == NULL)) {
+		zend_throw_error(NULL, "Cannot yield from outside a fiber");
 		return;
 	}
 
-	error = FIBER_G(error);
+	if (fiber->status != ZEND_FIBER_STATUS_RUNNING) {
+		zend_throw_error(NULL, "Cannot yield from a fiber that is not running");
+		return;
+	}
 
-	if (error != NULL) {
-		FIBER_G(error) = NULL;
-		exec = EG(current_execute_data);
+	/* Keep running if there is nothing else to do. */
+	if (FIBER_G(run_queue).head == NULL) {
+		return;
+	}
 
-		exec->opline--;
-		zend_throw_exception_object(error);
-		exec->opline++;
+	zend_fiber_schedule(fiber, NULL);
+	zend_fiber_park(fiber, NULL);
+}
+/* }}} */
+
+
+/* {{{ proto mixed Fiber::await(Fiber $fiber) */
+ZEND_METHOD(Fiber, await)
+{
+	zend_fiber *fiber;
+	zend_fiber *target;
+	zval *val;
+
+	ZEND_PARSE_PARAMETERS_START_EX(ZEND_PARSE_PARAMS_THROW, 1, 1)
+		Z_PARAM_OBJECT_OF_CLASS(val, zend_ce_fiber)
+	ZEND_PARSE_PARAMETERS_END();
+
+	fiber = FIBER_G(current_fiber);
+	target = (zend_fiber *) Z_OBJ_P(val);
+
+	if (UNEXPECTED(fiber == NULL)) {
+		zend_throw_error(NULL, "Cannot await from outside a fiber");
+		return;
+	}
+
+	if (UNEXPECTED(fiber == target)) {
+		zend_throw_error(NULL, "Fiber cannot await itself");
+		return;
+	}
+
+	if (target->status != ZEND_FIBER_STATUS_FINISHED && target->status != ZEND_FIBER_STATUS_DEAD) {
+		zend_fiber_queue_push(&target->awaiters, fiber);
+
+		if (!zend_fiber_park(fiber, NULL)) {
+			return;
+		}
+	}
+
+	if (target->status == ZEND_FIBER_STATUS_FINISHED) {
+		RETURN_ZVAL(&target->retval, 1, 0);
 	}
+
+	if (target->status == ZEND_FIBER_STATUS_DEAD) {
+		zend_throw_error(NULL, "Awaited fiber has been terminated");
+	} else {
+		zend_throw_error(NULL, "Fiber has been resumed before the awaited fiber terminated");
+	}
+}
+/* }}} */
+
+
+/* {{{ proto void Fiber::sleep(float $seconds) */
+ZEND_METHOD(Fiber, sleep)
+{
+	zend_fiber *fiber;
+	double seconds;
+
+	ZEND_PARSE_PARAMETERS_START_EX(ZEND_PARSE_PARAMS_THROW, 1, 1)
+		Z_PARAM_DOUBLE(seconds)
+	ZEND_PARSE_PARAMETERS_END();
+
+	fiber = FIBER_G(current_fiber);
+
+	if (UNEXPECTED(fiber == NULL)) {
+		zend_throw_error(NULL, "Cannot sleep outside a fiber");
+		return;
+	}
+
+	if (fiber->status != ZEND_FIBER_STATUS_RUNNING) {
+		zend_throw_error(NULL, "Cannot sleep in a fiber that is not running");
+		return;
+	}
+
+	zend_fiber_timer_start(&fiber->timer, zend_fiber_timer_deadline(seconds), zend_fiber_wakeup);
+
+	zend_fiber_park(fiber, NULL);
+
+	/* Resumed before the timer expired. */
+	zend_fiber_timer_stop(&fiber->timer);
+}
+/* }}} */
+
+
+/* {{{ proto mixed Fiber::transfer(Fiber $next [, mixed $value]) */
+ZEND_METHOD(Fiber, transfer)
+{
+	zend_fiber *fiber;
+	zend_fiber *next;
+	zval *obj;
+	zval *val;
+
+	val = NULL;
+
+	ZEND_PARSE_PARAMETERS_START_EX(ZEND_PARSE_PARAMS_THROW, 1, 2)
+		Z_PARAM_OBJECT_OF_CLASS(obj, zend_ce_fiber)
+		Z_PARAM_OPTIONAL
+		Z_PARAM_ZVAL(val)
+	ZEND_PARSE_PARAMETERS_END();
+
+	fiber = FIBER_G(current_fiber);
+	next = (zend_fiber *) Z_OBJ_P(obj);
+
+	if (UNEXPECTED(fiber == NULL)) {
+		zend_throw_error(NULL, "Cannot transfer from outside a fiber");
+		return;
+	}
+
+	if (fiber->status != ZEND_FIBER_STATUS_RUNNING) {
+		zend_throw_error(NULL, "Cannot transfer from a fiber that is not running");
+		return;
+	}
+
+	if (UNEXPECTED(fiber == next)) {
+		zend_throw_error(NULL, "Fiber cannot transfer to itself");
+		return;
+	}
+
+	if (next->status != ZEND_FIBER_STATUS_INIT && next->status != ZEND_FIBER_STATUS_SUSPENDED) {
+		zend_throw_error(NULL, "Cannot transfer to a fiber that is running or has terminated");
+		return;
+	}
+
+	/* Next may outlive the last reference held by the suspended fiber, keep it alive until it terminates. */
+	zend_fiber_attach(next);
+
+	zend_fiber_transfer(fiber, next, val, USED_RET() ? return_value : NULL);
+}
+/* }}} */
+
+
+/* {{{ proto void Fiber::cancel() */
+ZEND_METHOD(Fiber, cancel)
+{
+	zend_fiber *fiber;
+
+	ZEND_PARSE_PARAMETERS_NONE();
+
+	fiber = (zend_fiber *) Z_OBJ_P(getThis());
+
+	if (fiber->status == ZEND_FIBER_STATUS_FINISHED || fiber->status == ZEND_FIBER_STATUS_DEAD) {
+		return;
+	}
+
+	zend_fiber_cancellation_cancel(zend_fiber_cancellation_get(fiber), ZEND_FIBER_CANCELLED);
+}
+/* }}} */
+
+
+/* {{{ proto void Fiber::cancelAfter(float $seconds) */
+ZEND_METHOD(Fiber, cancelAfter)
+{
+	zend_fiber *fiber;
+	double seconds;
+
+	ZEND_PARSE_PARAMETERS_START_EX(ZEND_PARSE_PARAMS_THROW, 1, 1)
+		Z_PARAM_DOUBLE(seconds)
+	ZEND_PARSE_PARAMETERS_END();
+
+	fiber = (zend_fiber *) Z_OBJ_P(getThis());
+
+	if (fiber->status == ZEND_FIBER_STATUS_FINISHED || fiber->status == ZEND_FIBER_STATUS_DEAD) {
+		return;
+	}
+
+	zend_fiber_cancellation_set_deadline(fiber, zend_fiber_timer_deadline(seconds));
+}
+/* }}} */
+
+
+/* {{{ proto bool Fiber::isCancelled() */
+ZEND_METHOD(Fiber, isCancelled)
+{
+	zend_fiber *fiber;
+
+	ZEND_PARSE_PARAMETERS_NONE();
+
+	fiber = (zend_fiber *) Z_OBJ_P(getThis());
+
+	RETURN_BOOL(fiber->cancellation != NULL && fiber->cancellation->cancelled);
 }
 /* }}} */
 
@@ -426,6 +1566,24 @@ ZEND_END_ARG_INFO()
 ZEND_BEGIN_ARG_WITH_RETURN_TYPE_INFO_EX(arginfo_fiber_status, 0, 0, IS_LONG, 0)
 ZEND_END_ARG_INFO()
 
+ZEND_BEGIN_ARG_WITH_RETURN_TYPE_INFO_EX(arginfo_fiber_get_stack_usage, 0, 0, IS_LONG, 1)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_WITH_RETURN_TYPE_INFO_EX(arginfo_fiber_is, 0, 0, _IS_BOOL, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_fiber_get_return, 0, 0, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_WITH_RETURN_OBJ_INFO_EX(arginfo_fiber_get_current, 0, 0, Fiber, 1)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_WITH_RETURN_TYPE_INFO_EX(arginfo_fiber_get_stats, 0, 0, IS_ARRAY, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_WITH_RETURN_TYPE_INFO_EX(arginfo_fiber_get_profile, 0, 0, IS_ARRAY, 1)
+ZEND_END_ARG_INFO()
+
 ZEND_BEGIN_ARG_INFO(arginfo_fiber_start, 0)
 	ZEND_ARG_VARIADIC_INFO(0, arguments)
 ZEND_END_ARG_INFO()
@@ -434,6 +1592,11 @@ ZEND_BEGIN_ARG_INFO_EX(arginfo_fiber_resume, 0, 0, 1)
 	ZEND_ARG_INFO(0, value)
 ZEND_END_ARG_INFO()
 
+ZEND_BEGIN_ARG_WITH_RETURN_TYPE_INFO_EX(arginfo_fiber_resume_all, 0, 1, IS_ARRAY, 0)
+	ZEND_ARG_TYPE_INFO(0, fibers, IS_ARRAY, 0)
+	ZEND_ARG_TYPE_INFO(0, values, IS_ARRAY, 0)
+ZEND_END_ARG_INFO()
+
 ZEND_BEGIN_ARG_INFO(arginfo_fiber_throw, 0)
 	 ZEND_ARG_OBJ_INFO(0, exception, Throwable, 0)
 ZEND_END_ARG_INFO()
@@ -441,6 +1604,32 @@ ZEND_END_ARG_INFO()
 ZEND_BEGIN_ARG_INFO(arginfo_fiber_void, 0)
 ZEND_END_ARG_INFO()
 
+ZEND_BEGIN_ARG_WITH_RETURN_TYPE_INFO_EX(arginfo_fiber_yield, 0, 0, IS_VOID, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_fiber_await, 0, 0, 1)
+	ZEND_ARG_OBJ_INFO(0, fiber, Fiber, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_WITH_RETURN_TYPE_INFO_EX(arginfo_fiber_sleep, 0, 1, IS_VOID, 0)
+	ZEND_ARG_TYPE_INFO(0, seconds, IS_DOUBLE, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_fiber_transfer, 0, 0, 1)
+	ZEND_ARG_OBJ_INFO(0, next, Fiber, 0)
+	ZEND_ARG_INFO(0, value)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_WITH_RETURN_TYPE_INFO_EX(arginfo_fiber_cancel, 0, 0, IS_VOID, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_WITH_RETURN_TYPE_INFO_EX(arginfo_fiber_cancel_after, 0, 1, IS_VOID, 0)
+	ZEND_ARG_TYPE_INFO(0, seconds, IS_DOUBLE, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_WITH_RETURN_TYPE_INFO_EX(arginfo_fiber_is_cancelled, 0, 0, _IS_BOOL, 0)
+ZEND_END_ARG_INFO()
+
 ZEND_BEGIN_ARG_INFO_EX(arginfo_fiber_suspend, 0, 0, 0)
 	ZEND_ARG_INFO(0, value)
 ZEND_END_ARG_INFO()
@@ -448,10 +1637,27 @@ ZEND_END_ARG_INFO()
 static const zend_function_entry fiber_functions[] = {
 	ZEND_ME(Fiber, __construct, arginfo_fiber_create, ZEND_ACC_PUBLIC | ZEND_ACC_CTOR)
 	ZEND_ME(Fiber, status, arginfo_fiber_status, ZEND_ACC_PUBLIC)
+	ZEND_ME(Fiber, isRunning, arginfo_fiber_is, ZEND_ACC_PUBLIC)
+	ZEND_ME(Fiber, isSuspended, arginfo_fiber_is, ZEND_ACC_PUBLIC)
+	ZEND_ME(Fiber, isTerminated, arginfo_fiber_is, ZEND_ACC_PUBLIC)
+	ZEND_ME(Fiber, getReturn, arginfo_fiber_get_return, ZEND_ACC_PUBLIC)
+	ZEND_ME(Fiber, getCurrent, arginfo_fiber_get_current, ZEND_ACC_PUBLIC | ZEND_ACC_STATIC)
+	ZEND_ME(Fiber, getStackUsage, arginfo_fiber_get_stack_usage, ZEND_ACC_PUBLIC)
+	ZEND_ME(Fiber, getStats, arginfo_fiber_get_stats, ZEND_ACC_PUBLIC | ZEND_ACC_STATIC)
+	ZEND_ME(Fiber, getProfile, arginfo_fiber_get_profile, ZEND_ACC_PUBLIC)
+	ZEND_ME(Fiber, getSliceHistogram, arginfo_fiber_get_stats, ZEND_ACC_PUBLIC | ZEND_ACC_STATIC)
 	ZEND_ME(Fiber, start, arginfo_fiber_start, ZEND_ACC_PUBLIC)
 	ZEND_ME(Fiber, resume, arginfo_fiber_resume, ZEND_ACC_PUBLIC)
+	ZEND_ME(Fiber, resumeAll, arginfo_fiber_resume_all, ZEND_ACC_PUBLIC | ZEND_ACC_STATIC)
 	ZEND_ME(Fiber, throw, arginfo_fiber_throw, ZEND_ACC_PUBLIC)
 	ZEND_ME(Fiber, suspend, arginfo_fiber_suspend, ZEND_ACC_PUBLIC | ZEND_ACC_STATIC)
+	ZEND_ME(Fiber, yield, arginfo_fiber_yield, ZEND_ACC_PUBLIC | ZEND_ACC_STATIC)
+	ZEND_ME(Fiber, await, arginfo_fiber_await, ZEND_ACC_PUBLIC | ZEND_ACC_STATIC)
+	ZEND_ME(Fiber, sleep, arginfo_fiber_sleep, ZEND_ACC_PUBLIC | ZEND_ACC_STATIC)
+	ZEND_ME(Fiber, transfer, arginfo_fiber_transfer, ZEND_ACC_PUBLIC | ZEND_ACC_STATIC)
+	ZEND_ME(Fiber, cancel, arginfo_fiber_cancel, ZEND_ACC_PUBLIC)
+	ZEND_ME(Fiber, cancelAfter, arginfo_fiber_cancel_after, ZEND_ACC_PUBLIC)
+	ZEND_ME(Fiber, isCancelled, arginfo_fiber_is_cancelled, ZEND_ACC_PUBLIC)
 	ZEND_ME(Fiber, __wakeup, arginfo_fiber_void, ZEND_ACC_PUBLIC)
 	ZEND_FE_END
 };
@@ -496,7 +1702,9 @@ void zend_fiber_ce_register()
 	zend_ce_fiber->unserialize = zend_class_unserialize_deny;
 
 	memcpy(&zend_fiber_handlers, &std_object_handlers, sizeof(zend_object_handlers));
+	zend_fiber_handlers.dtor_obj = zend_fiber_object_dtor;
 	zend_fiber_handlers.free_obj = zend_fiber_object_destroy;
+	zend_fiber_handlers.get_gc = zend_fiber_object_gc;
 	zend_fiber_handlers.clone_obj = NULL;
 
 	REGISTER_FIBER_CLASS_CONST_LONG("STATUS_INIT", (zend_long)ZEND_FIBER_STATUS_INIT);
@@ -512,9 +1720,17 @@ void zend_fiber_ce_unregister()
 	fiber_run_func.function_name = NULL;
 }
 
+void zend_fiber_startup()
+{
+	FIBER_G(idle_head) = NULL;
+	FIBER_G(idle_tail) = NULL;
+	FIBER_G(reclaim_at) = 0;
+}
+
 void zend_fiber_shutdown()
 {
 	zend_fiber_context root;
+
 	root = FIBER_G(root);
 
 	FIBER_G(root) = NULL;
@@ -30,106 +30,108 @@ typedef struct _transfer_t {
 extern fcontext_t make_fcontext(void *sp, size_t size, void (*fn)(transfer_t));
 extern transfer_t jump_fcontext(fcontext_t to, void *vp);
 
-typedef struct _zend_fiber_context_asm {
+typedef struct _zend_fiber_context_asm zend_fiber_context_asm;
+
+/* Contexts of fibers live at the top of their own stack mapping, below the reserved block. */
+struct _zend_fiber_context_asm {
 	fcontext_t ctx;
-	fcontext_t caller;
+	zend_fiber_context_asm *caller;
 	zend_fiber_stack stack;
+	zend_fiber_func func;
 	zend_bool initialized;
 	zend_bool root;
-} zend_fiber_context_asm;
+};
 
-typedef struct _zend_fiber_record_asm {
-	zend_fiber_func func;
-} zend_fiber_record_asm;
+/* Bytes at the top of a stack mapping taken by the context, rounded to keep the C stack aligned. */
+#define ZEND_FIBER_ASM_CONTEXT_SIZE ZEND_MM_ALIGNED_SIZE_EX(sizeof(zend_fiber_context_asm), 64)
 
 void zend_fiber_asm_start(transfer_t trans)
 {
-	zend_fiber_record_asm *record;
 	zend_fiber_context_asm *context;
 
-	record = (zend_fiber_record_asm *) trans.data;
+	context = (zend_fiber_context_asm *) trans.data;
 
 	trans = jump_fcontext(trans.ctx, 0);
-	context = (zend_fiber_context_asm *) trans.data;
 
-	if (context != NULL) {
-		context->caller = trans.ctx;
-	}
+	((zend_fiber_context_asm *) trans.data)->ctx = trans.ctx;
 
-	record->func();
+	context->func();
 }
 
-zend_fiber_context zend_fiber_create_root_context()
+/* Every context saves its own stack pointer when left, so any context can jump into any other. */
+static zend_always_inline void zend_fiber_asm_jump(zend_fiber_context_asm *from, zend_fiber_context_asm *to)
 {
-	zend_fiber_context_asm *context;
+	transfer_t trans;
 
-	context = emalloc(sizeof(zend_fiber_context_asm));
-	ZEND_SECURE_ZERO(context, sizeof(zend_fiber_context_asm));
-
-	context->initialized = 1;
-	context->root = 1;
+	trans = jump_fcontext(to->ctx, from);
 
-	return (zend_fiber_context) context;
+	((zend_fiber_context_asm *) trans.data)->ctx = trans.ctx;
 }
 
-zend_fiber_context zend_fiber_create_context()
+zend_fiber_context zend_fiber_create_root_context()
 {
 	zend_fiber_context_asm *context;
 
 	context = emalloc(sizeof(zend_fiber_context_asm));
 	ZEND_SECURE_ZERO(context, sizeof(zend_fiber_context_asm));
 
+	context->initialized = 1;
+	context->root = 1;
+
 	return (zend_fiber_context) context;
 }
 
-zend_bool zend_fiber_create(zend_fiber_context ctx, zend_fiber_func func, size_t stack_size)
+zend_fiber_context zend_fiber_create(zend_fiber_func func, size_t stack_size, size_t reserved_size, void **reserved)
 {
-	static __thread size_t record_size;
-
 	zend_fiber_context_asm *context;
-	zend_fiber_record_asm *record;
+	zend_fiber_stack stack;
+	char *top;
 
-	context = (zend_fiber_context_asm *) ctx;
+	reserved_size = ZEND_MM_ALIGNED_SIZE_EX(reserved_size, 64);
 
-	if (UNEXPECTED(context->initialized == 1)) {
-		return 0;
+	/* One mapping holds the C stack, the context and the reserved block. */
+	if (!zend_fiber_stack_allocate(&stack, stack_size + ZEND_FIBER_ASM_CONTEXT_SIZE + reserved_size)) {
+		return NULL;
 	}
 
-	if (!zend_fiber_stack_allocate(&context->stack, stack_size)) {
-		return 0;
-	}
+	top = (char *) stack.pointer + stack.size - reserved_size;
 
-	if (!record_size) {
-		record_size = (size_t) ceil((double) sizeof(zend_fiber_record_asm) / 64) * 64;
+	if (reserved != NULL) {
+		*reserved = (reserved_size > 0) ? (void *) top : NULL;
 	}
 
-	void *sp = (void *) (context->stack.size - record_size + (char *) context->stack.pointer);
+	context = (zend_fiber_context_asm *) (top - ZEND_FIBER_ASM_CONTEXT_SIZE);
+	ZEND_SECURE_ZERO(context, sizeof(zend_fiber_context_asm));
 
-	record = (zend_fiber_record_asm *) sp;
-	record->func = func;
+	context->stack = stack;
+	context->func = func;
 
-	sp -= 64;
+	void *sp = (void *) ((char *) context - 64);
 
 	context->ctx = make_fcontext(sp, sp - (void *) context->stack.pointer, &zend_fiber_asm_start);
-	context->ctx = jump_fcontext(context->ctx, record).ctx;
+	context->ctx = jump_fcontext(context->ctx, context).ctx;
 
 	context->initialized = 1;
 
-	return 1;
+	return (zend_fiber_context) context;
 }
 
 void zend_fiber_destroy(zend_fiber_context ctx)
 {
 	zend_fiber_context_asm *context;
+	zend_fiber_stack stack;
 
 	context = (zend_fiber_context_asm *) ctx;
 
 	if (context != NULL) {
-		if (!context->root && context->initialized) {
-			zend_fiber_stack_free(&context->stack);
+		if (context->root) {
+			efree(context);
+		} else {
+			/* The context is part of the mapping being released. */
+			stack = context->stack;
+			zend_fiber_stack_free(&stack);
 		}
 
-		efree(context);
 		context = NULL;
 	}
 }
@@ -150,11 +152,72 @@ zend_bool zend_fiber_switch_context(zend_fiber_context current, zend_fiber_conte
 		return 0;
 	}
 
-	to->ctx = jump_fcontext(to->ctx, to).ctx;
+	to->caller = from;
+
+	zend_fiber_asm_jump(from, to);
 
 	return 1;
 }
 
+zend_bool zend_fiber_transfer_context(zend_fiber_context current, zend_fiber_context next)
+{
+	zend_fiber_context_asm *from;
+	zend_fiber_context_asm *to;
+
+	if (UNEXPECTED(current == NULL) || UNEXPECTED(next == NULL)) {
+		return 0;
+	}
+
+	from = (zend_fiber_context_asm *) current;
+	to = (zend_fiber_context_asm *) next;
+
+	if (UNEXPECTED(from->initialized == 0) || UNEXPECTED(to->initialized == 0) || UNEXPECTED(from->caller == NULL)) {
+		return 0;
+	}
+
+	/* Next takes over the caller of the current context, suspending it returns there. */
+	to->caller = from->caller;
+
+	zend_fiber_asm_jump(from, to);
+
+	return 1;
+}
+
+size_t zend_fiber_stack_usage(zend_fiber_context ctx)
+{
+	zend_fiber_context_asm *context;
+
+	context = (zend_fiber_context_asm *) ctx;
+
+	size_t usage;
+	size_t above;
+
+	if (context == NULL || context->root || !context->initialized) {
+		return 0;
+	}
+
+	usage = zend_fiber_stack_measure(&context->stack);
+
+	/* Do not count the context and the reserved block above the C stack. */
+	above = (char *) context->stack.pointer + context->stack.size - (char *) context;
+
+	return (usage > above) ? usage - above : 0;
+}
+
+void zend_fiber_reclaim(zend_fiber_context ctx)
+{
+	zend_fiber_context_asm *context;
+
+	context = (zend_fiber_context_asm *) ctx;
+
+	if (context == NULL || context->root || !context->initialized) {
+		return;
+	}
+
+	/* The context of a suspended fiber is its saved stack pointer. */
+	zend_fiber_stack_reclaim(&context->stack, (void *) context->ctx);
+}
+
 zend_bool zend_fiber_suspend(zend_fiber_context current)
 {
 	zend_fiber_context_asm *fiber;
@@ -165,11 +228,11 @@ zend_bool zend_fiber_suspend(zend_fiber_context current)
 
 	fiber = (zend_fiber_context_asm *) current;
 
-	if (UNEXPECTED(fiber->initialized == 0)) {
+	if (UNEXPECTED(fiber->initialized == 0) || UNEXPECTED(fiber->caller == NULL)) {
 		return 0;
 	}
 
-	fiber->caller = jump_fcontext(fiber->caller, 0).ctx;
+	zend_fiber_asm_jump(fiber, fiber->caller);
 
 	return 1;
 }
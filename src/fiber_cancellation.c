@@ -0,0 +1,207 @@
+/*
+  +--------------------------------------------------------------------+
+  | ext-fiber                                                          |
+  +--------------------------------------------------------------------+
+  | Redistribution and use in source and binary forms, with or without |
+  | modification, are permitted provided that the conditions mentioned |
+  | in the accompanying LICENSE file are met.                          |
+  +--------------------------------------------------------------------+
+  | Authors: Martin Schröder <m.schroeder2007@gmail.com>               |
+  |          Aaron Piotrowski <aaron@trowski.com>                      |
+  +--------------------------------------------------------------------+
+*/
+
+#include "php.h"
+#include "zend.h"
+#include "zend_API.h"
+#include "zend_exceptions.h"
+
+#include "php_fiber.h"
+#include "fiber.h"
+#include "fiber_cancellation.h"
+#include "fiber_scheduler.h"
+#include "fiber_timer.h"
+
+static zend_class_entry *zend_ce_fiber_cancelled_error;
+
+
+static void zend_fiber_cancellation_unref(zend_fiber_cancellation *token)
+{
+	zend_fiber_cancellation *parent;
+
+	while (token != NULL && --token->refcount == 0) {
+		parent = token->parent;
+
+		zend_fiber_timer_stop(&token->timer);
+
+		if (parent != NULL) {
+			if (token->prev != NULL) {
+				token->prev->next = token->next;
+			} else {
+				parent->children = token->next;
+			}
+
+			if (token->next != NULL) {
+				token->next->prev = token->prev;
+			}
+		}
+
+		efree(token);
+
+		/* The reference held on the parent is dropped iteratively to avoid deep recursion. */
+		token = parent;
+	}
+}
+
+
+zend_fiber_cancellation *zend_fiber_cancellation_get(zend_fiber *fiber)
+{
+	zend_fiber_cancellation *token;
+
+	token = fiber->cancellation;
+
+	if (token == NULL) {
+		token = emalloc(sizeof(zend_fiber_cancellation));
+		memset(token, 0, sizeof(zend_fiber_cancellation));
+
+		token->refcount = 1;
+		token->fiber = fiber;
+
+		fiber->cancellation = token;
+	}
+
+	return token;
+}
+
+
+void zend_fiber_cancellation_inherit(zend_fiber *fiber, zend_fiber *parent)
+{
+	zend_fiber_cancellation *token;
+
+	if (parent == NULL) {
+		return;
+	}
+
+	token = zend_fiber_cancellation_get(fiber);
+
+	if (token->parent != NULL || token == parent->cancellation) {
+		return;
+	}
+
+	/* The parent may only be cancelled after starting its children, its token is created right away. */
+	token->parent = zend_fiber_cancellation_get(parent);
+	token->parent->refcount++;
+
+	token->prev = NULL;
+	token->next = token->parent->children;
+
+	if (token->next != NULL) {
+		token->next->prev = token;
+	}
+
+	token->parent->children = token;
+
+	if (token->parent->cancelled) {
+		zend_fiber_cancellation_cancel(token, token->parent->cancelled);
+	}
+}
+
+
+void zend_fiber_cancellation_cancel(zend_fiber_cancellation *token, zend_uchar reason)
+{
+	zend_fiber_cancellation *child;
+	zend_fiber *fiber;
+
+	if (token->cancelled) {
+		return;
+	}
+
+	token->cancelled = reason;
+
+	zend_fiber_timer_stop(&token->timer);
+
+	fiber = token->fiber;
+
+	/* Cut waits short, the fiber throws as soon as it is running again. */
+	if (fiber != NULL && fiber->parked && fiber->queue != &FIBER_G(run_queue)) {
+		zend_fiber_schedule(fiber, NULL);
+	}
+
+	for (child = token->children; child != NULL; child = child->next) {
+		zend_fiber_cancellation_cancel(child, reason);
+	}
+}
+
+
+static void zend_fiber_cancellation_expire(zend_fiber_timer *timer)
+{
+	zend_fiber_cancellation_cancel(ZEND_FIBER_CANCELLATION_FROM_TIMER(timer), ZEND_FIBER_DEADLINE_EXCEEDED);
+}
+
+
+void zend_fiber_cancellation_set_deadline(zend_fiber *fiber, uint64_t deadline)
+{
+	zend_fiber_cancellation *token;
+
+	token = zend_fiber_cancellation_get(fiber);
+
+	if (token->cancelled) {
+		return;
+	}
+
+	zend_fiber_timer_start(&token->timer, deadline, zend_fiber_cancellation_expire);
+}
+
+
+void zend_fiber_cancellation_release(zend_fiber *fiber)
+{
+	zend_fiber_cancellation *token;
+
+	token = fiber->cancellation;
+
+	if (token == NULL) {
+		return;
+	}
+
+	fiber->cancellation = NULL;
+	token->fiber = NULL;
+
+	zend_fiber_cancellation_unref(token);
+}
+
+
+zend_bool zend_fiber_cancellation_check(zend_fiber *fiber)
+{
+	zend_fiber_cancellation *token;
+
+	token = fiber->cancellation;
+
+	if (EXPECTED(token == NULL || !token->cancelled)) {
+		return 1;
+	}
+
+	if (!EG(exception)) {
+		if (token->cancelled == ZEND_FIBER_DEADLINE_EXCEEDED) {
+			zend_throw_exception(zend_ce_fiber_cancelled_error, "Fiber deadline has been exceeded", 0);
+		} else {
+			zend_throw_exception(zend_ce_fiber_cancelled_error, "Fiber has been cancelled", 0);
+		}
+	}
+
+	return 0;
+}
+
+
+void zend_fiber_cancellation_ce_register()
+{
+	zend_class_entry ce;
+
+	INIT_CLASS_ENTRY(ce, "FiberCancelledError", NULL);
+	zend_ce_fiber_cancelled_error = zend_register_internal_class_ex(&ce, zend_ce_error);
+	zend_ce_fiber_cancelled_error->ce_flags |= ZEND_ACC_FINAL;
+}
+
+/*
+ * vim: sw=4 ts=4
+ * vim600: fdm=marker
+ */
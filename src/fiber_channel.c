@@ -0,0 +1,418 @@
+/*
+  +--------------------------------------------------------------------+
+  | ext-fiber                                                          |
+  +--------------------------------------------------------------------+
+  | Redistribution and use in source and binary forms, with or without |
+  | modification, are permitted provided that the conditions mentioned |
+  | in the accompanying LICENSE file are met.                          |
+  +--------------------------------------------------------------------+
+  | Authors: Martin Schröder <m.schroeder2007@gmail.com>               |
+  |          Aaron Piotrowski <aaron@trowski.com>                      |
+  +--------------------------------------------------------------------+
+*/
+
+#include "php.h"
+#include "zend.h"
+#include "zend_API.h"
+#include "zend_exceptions.h"
+
+#include "php_fiber.h"
+#include "fiber.h"
+#include "fiber_channel.h"
+#include "fiber_scheduler.h"
+
+#ifndef ZEND_PARSE_PARAMETERS_NONE
+#define ZEND_PARSE_PARAMETERS_NONE() zend_parse_parameters_none()
+#endif
+
+static zend_class_entry *zend_ce_fiber_channel;
+static zend_object_handlers zend_fiber_channel_handlers;
+
+#define ZEND_FIBER_CHANNEL_SLOT(channel, offset) (&(channel)->buffer[((channel)->head + (offset)) % (channel)->capacity])
+
+
+static zend_object *zend_fiber_channel_object_create(zend_class_entry *ce)
+{
+	zend_fiber_channel *channel;
+
+	channel = emalloc(sizeof(zend_fiber_channel));
+	memset(channel, 0, sizeof(zend_fiber_channel));
+
+	zend_object_std_init(&channel->std, ce);
+	channel->std.handlers = &zend_fiber_channel_handlers;
+
+	return &channel->std;
+}
+
+
+static void zend_fiber_channel_object_destroy(zend_object *object)
+{
+	zend_fiber_channel *channel;
+	uint32_t i;
+
+	channel = (zend_fiber_channel *) object;
+
+	/* Waiting fibers reference the channel, it is only freed with them on shutdown or by the collector. */
+	while (zend_fiber_queue_shift(&channel->senders) != NULL);
+	while (zend_fiber_queue_shift(&channel->receivers) != NULL);
+
+	if (channel->buffer != NULL) {
+		for (i = 0; i < channel->count; i++) {
+			zval_ptr_dtor(ZEND_FIBER_CHANNEL_SLOT(channel, i));
+		}
+
+		efree(channel->buffer);
+	}
+
+	if (channel->gc_buffer != NULL) {
+		efree(channel->gc_buffer);
+	}
+
+	zend_object_std_dtor(&channel->std);
+}
+
+
+#if PHP_VERSION_ID >= 80000
+static HashTable *zend_fiber_channel_get_gc(zend_object *object, zval **table, int *n)
+#else
+static HashTable *zend_fiber_channel_get_gc(zval *object, zval **table, int *n)
+#endif
+{
+	zend_fiber_channel *channel;
+	uint32_t count;
+	uint32_t i;
+
+#if PHP_VERSION_ID >= 80000
+	channel = (zend_fiber_channel *) object;
+#else
+	channel = (zend_fiber_channel *) Z_OBJ_P(object);
+#endif
+
+	count = 0;
+
+	if (channel->count > 0 && channel->gc_size < channel->count) {
+		channel->gc_size = channel->count;
+		channel->gc_buffer = safe_erealloc(channel->gc_buffer, channel->gc_size, sizeof(zval), 0);
+	}
+
+	for (i = 0; i < channel->count; i++) {
+		ZVAL_COPY_VALUE(&channel->gc_buffer[count++], ZEND_FIBER_CHANNEL_SLOT(channel, i));
+	}
+
+	/* Parked fibers are referenced by the channel, a cycle through their stack can be collected then. */
+	count = zend_fiber_queue_gc(&channel->senders, &channel->gc_buffer, &channel->gc_size, count);
+	count = zend_fiber_queue_gc(&channel->receivers, &channel->gc_buffer, &channel->gc_size, count);
+
+	*table = channel->gc_buffer;
+	*n = (int) count;
+
+	return zend_std_get_properties(object);
+}
+
+
+/* Blocks the running fiber in the given wait queue of the channel until a peer takes or provides a value. */
+static zend_bool zend_fiber_channel_wait(zend_fiber_queue *queue, zval *slot)
+{
+	zend_fiber *fiber;
+	zend_bool result;
+
+	fiber = FIBER_G(current_fiber);
+
+	if (UNEXPECTED(fiber == NULL)) {
+		zend_throw_error(NULL, "Cannot wait on a channel outside a fiber");
+		return 0;
+	}
+
+	if (fiber->status != ZEND_FIBER_STATUS_RUNNING) {
+		zend_throw_error(NULL, "Cannot wait on a channel in a fiber that is not running");
+		return 0;
+	}
+
+	fiber->wait_value = slot;
+
+	zend_fiber_queue_push(queue, fiber);
+
+	result = zend_fiber_park(fiber, NULL);
+
+	fiber->wait_value = NULL;
+
+	return result;
+}
+
+
+/* {{{ proto FiberChannel::__construct(int $capacity = 0) */
+ZEND_METHOD(FiberChannel, __construct)
+{
+	zend_fiber_channel *channel;
+	zend_long capacity;
+
+	channel = (zend_fiber_channel *) Z_OBJ_P(getThis());
+	capacity = 0;
+
+	ZEND_PARSE_PARAMETERS_START_EX(ZEND_PARSE_PARAMS_THROW, 0, 1)
+		Z_PARAM_OPTIONAL
+		Z_PARAM_LONG(capacity)
+	ZEND_PARSE_PARAMETERS_END();
+
+	if (channel->buffer != NULL) {
+		zend_throw_error(NULL, "Channel has already been constructed");
+		return;
+	}
+
+	if (capacity < 0 || (zend_ulong) capacity > UINT32_MAX) {
+		zend_throw_error(NULL, "Channel capacity must be between 0 and %u", UINT32_MAX);
+		return;
+	}
+
+	channel->capacity = (uint32_t) capacity;
+
+	if (capacity > 0) {
+		channel->buffer = safe_emalloc(channel->capacity, sizeof(zval), 0);
+
+		memset(channel->buffer, 0, channel->capacity * sizeof(zval));
+	}
+}
+/* }}} */
+
+
+/* {{{ proto void FiberChannel::send(mixed $value) */
+ZEND_METHOD(FiberChannel, send)
+{
+	zend_fiber_channel *channel;
+	zend_fiber *receiver;
+	zval *val;
+	zval slot;
+
+	ZEND_PARSE_PARAMETERS_START_EX(ZEND_PARSE_PARAMS_THROW, 1, 1)
+		Z_PARAM_ZVAL(val)
+	ZEND_PARSE_PARAMETERS_END();
+
+	channel = (zend_fiber_channel *) Z_OBJ_P(getThis());
+
+	if (channel->closed) {
+		zend_throw_error(NULL, "Cannot send on a closed channel");
+		return;
+	}
+
+	/* Receivers only wait on an empty buffer, the value is handed over directly. */
+	receiver = zend_fiber_queue_shift(&channel->receivers);
+
+	if (receiver != NULL) {
+		ZVAL_COPY(receiver->wait_value, val);
+		zend_fiber_schedule(receiver, NULL);
+		return;
+	}
+
+	if (channel->count < channel->capacity) {
+		ZVAL_COPY(ZEND_FIBER_CHANNEL_SLOT(channel, channel->count), val);
+		channel->count++;
+		return;
+	}
+
+	ZVAL_COPY(&slot, val);
+
+	zend_fiber_channel_wait(&channel->senders, &slot);
+
+	/* A receiver moves the value out of the slot before it wakes the sender up. */
+	if (Z_ISUNDEF(slot)) {
+		return;
+	}
+
+	zval_ptr_dtor(&slot);
+
+	if (EG(exception)) {
+		return;
+	}
+
+	if (channel->closed) {
+		zend_throw_error(NULL, "Channel has been closed while sending");
+	} else {
+		zend_throw_error(NULL, "Fiber has been resumed before the value has been received");
+	}
+}
+/* }}} */
+
+
+/* {{{ proto mixed FiberChannel::receive() */
+ZEND_METHOD(FiberChannel, receive)
+{
+	zend_fiber_channel *channel;
+	zend_fiber *sender;
+	zval *value;
+	zval slot;
+
+	ZEND_PARSE_PARAMETERS_NONE();
+
+	channel = (zend_fiber_channel *) Z_OBJ_P(getThis());
+	sender = zend_fiber_queue_shift(&channel->senders);
+
+	if (channel->count > 0) {
+		value = ZEND_FIBER_CHANNEL_SLOT(channel, 0);
+
+		ZVAL_COPY_VALUE(return_value, value);
+		ZVAL_UNDEF(value);
+
+		channel->head = (channel->head + 1) % channel->capacity;
+		channel->count--;
+
+		/* Refill the buffer from the longest waiting sender. */
+		if (sender != NULL) {
+			value = ZEND_FIBER_CHANNEL_SLOT(channel, channel->count);
+
+			ZVAL_COPY_VALUE(value, sender->wait_value);
+			ZVAL_UNDEF(sender->wait_value);
+
+			channel->count++;
+
+			zend_fiber_schedule(sender, NULL);
+		}
+
+		return;
+	}
+
+	if (sender != NULL) {
+		ZVAL_COPY_VALUE(return_value, sender->wait_value);
+		ZVAL_UNDEF(sender->wait_value);
+
+		zend_fiber_schedule(sender, NULL);
+		return;
+	}
+
+	if (channel->closed) {
+		return;
+	}
+
+	ZVAL_UNDEF(&slot);
+
+	zend_fiber_channel_wait(&channel->receivers, &slot);
+
+	if (!Z_ISUNDEF(slot)) {
+		if (EG(exception)) {
+			zval_ptr_dtor(&slot);
+			return;
+		}
+
+		ZVAL_COPY_VALUE(return_value, &slot);
+		return;
+	}
+
+	if (EG(exception) || channel->closed) {
+		return;
+	}
+
+	zend_throw_error(NULL, "Fiber has been resumed before a value has been received");
+}
+/* }}} */
+
+
+/* {{{ proto void FiberChannel::close() */
+ZEND_METHOD(FiberChannel, close)
+{
+	zend_fiber_channel *channel;
+	zend_fiber *fiber;
+
+	ZEND_PARSE_PARAMETERS_NONE();
+
+	channel = (zend_fiber_channel *) Z_OBJ_P(getThis());
+
+	if (channel->closed) {
+		return;
+	}
+
+	channel->closed = 1;
+
+	/* Buffered values can still be received, blocked fibers are woken up without a value. */
+	while ((fiber = zend_fiber_queue_shift(&channel->receivers)) != NULL) {
+		zend_fiber_schedule(fiber, NULL);
+	}
+
+	while ((fiber = zend_fiber_queue_shift(&channel->senders)) != NULL) {
+		zend_fiber_schedule(fiber, NULL);
+	}
+}
+/* }}} */
+
+
+/* {{{ proto bool FiberChannel::isClosed() */
+ZEND_METHOD(FiberChannel, isClosed)
+{
+	ZEND_PARSE_PARAMETERS_NONE();
+
+	RETURN_BOOL(((zend_fiber_channel *) Z_OBJ_P(getThis()))->closed);
+}
+/* }}} */
+
+
+/* {{{ proto int FiberChannel::count() */
+ZEND_METHOD(FiberChannel, count)
+{
+	ZEND_PARSE_PARAMETERS_NONE();
+
+	RETURN_LONG((zend_long) ((zend_fiber_channel *) Z_OBJ_P(getThis()))->count);
+}
+/* }}} */
+
+
+/* {{{ proto int FiberChannel::getCapacity() */
+ZEND_METHOD(FiberChannel, getCapacity)
+{
+	ZEND_PARSE_PARAMETERS_NONE();
+
+	RETURN_LONG((zend_long) ((zend_fiber_channel *) Z_OBJ_P(getThis()))->capacity);
+}
+/* }}} */
+
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_channel_create, 0, 0, 0)
+	ZEND_ARG_TYPE_INFO(0, capacity, IS_LONG, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_WITH_RETURN_TYPE_INFO_EX(arginfo_channel_send, 0, 1, IS_VOID, 0)
+	ZEND_ARG_INFO(0, value)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_channel_receive, 0, 0, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_WITH_RETURN_TYPE_INFO_EX(arginfo_channel_close, 0, 0, IS_VOID, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_WITH_RETURN_TYPE_INFO_EX(arginfo_channel_is_closed, 0, 0, _IS_BOOL, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_WITH_RETURN_TYPE_INFO_EX(arginfo_channel_count, 0, 0, IS_LONG, 0)
+ZEND_END_ARG_INFO()
+
+static const zend_function_entry channel_functions[] = {
+	ZEND_ME(FiberChannel, __construct, arginfo_channel_create, ZEND_ACC_PUBLIC | ZEND_ACC_CTOR)
+	ZEND_ME(FiberChannel, send, arginfo_channel_send, ZEND_ACC_PUBLIC)
+	ZEND_ME(FiberChannel, receive, arginfo_channel_receive, ZEND_ACC_PUBLIC)
+	ZEND_ME(FiberChannel, close, arginfo_channel_close, ZEND_ACC_PUBLIC)
+	ZEND_ME(FiberChannel, isClosed, arginfo_channel_is_closed, ZEND_ACC_PUBLIC)
+	ZEND_ME(FiberChannel, count, arginfo_channel_count, ZEND_ACC_PUBLIC)
+	ZEND_ME(FiberChannel, getCapacity, arginfo_channel_count, ZEND_ACC_PUBLIC)
+	ZEND_FE_END
+};
+
+
+void zend_fiber_channel_ce_register()
+{
+	zend_class_entry ce;
+
+	INIT_CLASS_ENTRY(ce, "FiberChannel", channel_functions);
+	zend_ce_fiber_channel = zend_register_internal_class(&ce);
+	zend_ce_fiber_channel->ce_flags |= ZEND_ACC_FINAL;
+	zend_ce_fiber_channel->create_object = zend_fiber_channel_object_create;
+	zend_ce_fiber_channel->serialize = zend_class_serialize_deny;
+	zend_ce_fiber_channel->unserialize = zend_class_unserialize_deny;
+
+	memcpy(&zend_fiber_channel_handlers, &std_object_handlers, sizeof(zend_object_handlers));
+	zend_fiber_channel_handlers.free_obj = zend_fiber_channel_object_destroy;
+	zend_fiber_channel_handlers.get_gc = zend_fiber_channel_get_gc;
+	zend_fiber_channel_handlers.clone_obj = NULL;
+}
+
+/*
+ * vim: sw=4 ts=4
+ * vim600: fdm=marker
+ */
@@ -0,0 +1,530 @@
+/*
+  +--------------------------------------------------------------------+
+  | ext-fiber                                                          |
+  +--------------------------------------------------------------------+
+  | Redistribution and use in source and binary forms, with or without |
+  | modification, are permitted provided that the conditions mentioned |
+  | in the accompanying LICENSE file are met.                          |
+  +--------------------------------------------------------------------+
+  | Authors: Martin Schröder <m.schroeder2007@gmail.com>               |
+  |          Aaron Piotrowski <aaron@trowski.com>                      |
+  +--------------------------------------------------------------------+
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "php.h"
+#include "php_network.h"
+#include "zend.h"
+#include "zend_API.h"
+#include "ext/standard/file.h"
+
+#include "php_fiber.h"
+#include "fiber.h"
+#include "fiber_scheduler.h"
+#include "fiber_reactor.h"
+#include "fiber_timer.h"
+#include "fiber_hook.h"
+
+#ifndef PHP_WIN32
+#include <sys/socket.h>
+#endif
+
+#if PHP_VERSION_ID >= 70400
+typedef ssize_t zend_fiber_stream_io_t;
+#else
+typedef size_t zend_fiber_stream_io_t;
+#endif
+
+/* Copy of the ops of a socket stream with read, write, close and set_option replaced, the original ops are
+ * put back while calling into them because xp_socket.c compares stream->ops to its own tables. */
+typedef struct _zend_fiber_hooked_ops {
+	php_stream_ops ops;
+	const php_stream_ops *orig;
+} zend_fiber_hooked_ops;
+
+typedef struct _zend_fiber_hooked_transport {
+	const char *name;
+	php_stream_transport_factory factory;
+} zend_fiber_hooked_transport;
+
+#define ZEND_FIBER_HOOKED_OPS_MAX 8
+
+/* Labels of the ops tables of xp_socket.c, most of them are not exported. Other extensions (openssl) register
+ * factories for the same transports, their streams buffer data the readiness checks of the hooks cannot see. */
+static const char *zend_fiber_hooked_labels[] = {
+	"generic_socket",
+	"tcp_socket",
+	"udp_socket",
+	"unix_socket",
+	"udg_socket",
+	NULL
+};
+
+static zend_fiber_hooked_transport zend_fiber_hooked_transports[] = {
+	{ "tcp", NULL },
+	{ "udp", NULL },
+#ifdef AF_UNIX
+	{ "unix", NULL },
+	{ "udg", NULL },
+#endif
+	{ NULL, NULL }
+};
+
+static zend_fiber_hooked_ops zend_fiber_hooked_ops_table[ZEND_FIBER_HOOKED_OPS_MAX];
+static int zend_fiber_hooked_ops_count;
+
+#ifdef ZTS
+static MUTEX_T zend_fiber_hooked_ops_mutex;
+#endif
+
+static zif_handler zend_fiber_hook_orig_sleep;
+static zif_handler zend_fiber_hook_orig_usleep;
+
+#define ZEND_FIBER_HOOK_CALL(result, stream, hooked, call) do { \
+	(stream)->ops = (hooked)->orig; \
+	result = call; \
+	if ((stream)->ops == (hooked)->orig) { \
+		(stream)->ops = &(hooked)->ops; \
+	} \
+} while (0)
+
+
+/* Blocking calls are only turned into suspensions while the scheduler is able to resume the fiber. */
+static zend_always_inline zend_fiber *zend_fiber_hook_fiber()
+{
+	zend_fiber *fiber;
+
+	fiber = FIBER_G(current_fiber);
+
+	if (fiber == NULL || fiber->status != ZEND_FIBER_STATUS_RUNNING || !FIBER_G(scheduler_running) || !FIBER_G(reactor).active) {
+		return NULL;
+	}
+
+	return fiber;
+}
+
+
+static void zend_fiber_hook_sleep_for(zend_fiber *fiber, double seconds)
+{
+	/* The deadline is clamped, huge durations must not overflow into short sleeps. */
+	zend_fiber_timer_start(&fiber->timer, zend_fiber_timer_deadline(seconds), zend_fiber_wakeup);
+
+	zend_fiber_park(fiber, NULL);
+	zend_fiber_timer_stop(&fiber->timer);
+}
+
+
+/* Waits until the socket is ready or its timeout expires, the timeout is reported like xp_socket.c does it. */
+static zend_bool zend_fiber_hook_wait(zend_fiber *fiber, php_socket_t fd, int events, struct timeval *timeout, char *timeout_event)
+{
+	zval result;
+
+	if (php_pollfd_for_ms(fd, (events == ZEND_FIBER_READABLE) ? POLLIN : POLLOUT, 0) > 0) {
+		return 1;
+	}
+
+	if (timeout != NULL && timeout->tv_sec >= 0) {
+		zend_fiber_timer_start(&fiber->timer, zend_fiber_timer_deadline((double) timeout->tv_sec + (double) timeout->tv_usec / 1.0e6), zend_fiber_wakeup);
+	}
+
+	ZVAL_NULL(&result);
+
+	zend_fiber_reactor_wait(fiber, fd, events, &result);
+	zend_fiber_timer_stop(&fiber->timer);
+
+	if (EG(exception)) {
+		return 0;
+	}
+
+	if (Z_TYPE(result) != IS_LONG) {
+		if (timeout_event != NULL) {
+			*timeout_event = 1;
+		}
+
+		return 0;
+	}
+
+	return 1;
+}
+
+
+static zend_fiber_hooked_ops *zend_fiber_hook_ops(const php_stream_ops *orig)
+{
+	zend_fiber_hooked_ops *hooked;
+	int i;
+
+	hooked = NULL;
+
+#ifdef ZTS
+	tsrm_mutex_lock(zend_fiber_hooked_ops_mutex);
+#endif
+
+	for (i = 0; i < zend_fiber_hooked_ops_count; i++) {
+		if (zend_fiber_hooked_ops_table[i].orig == orig) {
+			hooked = &zend_fiber_hooked_ops_table[i];
+			break;
+		}
+	}
+
+	if (hooked == NULL && zend_fiber_hooked_ops_count < ZEND_FIBER_HOOKED_OPS_MAX) {
+		hooked = &zend_fiber_hooked_ops_table[zend_fiber_hooked_ops_count];
+
+		memcpy(&hooked->ops, orig, sizeof(php_stream_ops));
+		hooked->orig = orig;
+
+		zend_fiber_hooked_ops_count++;
+	}
+
+#ifdef ZTS
+	tsrm_mutex_unlock(zend_fiber_hooked_ops_mutex);
+#endif
+
+	return hooked;
+}
+
+
+static void zend_fiber_hook_stream(php_stream *stream);
+
+
+static zend_fiber_stream_io_t zend_fiber_hook_read(php_stream *stream, char *buf, size_t count)
+{
+	zend_fiber_hooked_ops *hooked;
+	php_netstream_data_t *sock;
+	zend_fiber_stream_io_t result;
+	zend_fiber *fiber;
+
+	hooked = (zend_fiber_hooked_ops *) stream->ops;
+	sock = (php_netstream_data_t *) stream->abstract;
+	fiber = zend_fiber_hook_fiber();
+
+	if (fiber != NULL && sock != NULL && sock->is_blocked) {
+		sock->timeout_event = 0;
+
+		if (!zend_fiber_hook_wait(fiber, sock->socket, ZEND_FIBER_READABLE, &sock->timeout, &sock->timeout_event)) {
+			return 0;
+		}
+	}
+
+	ZEND_FIBER_HOOK_CALL(result, stream, hooked, hooked->orig->read(stream, buf, count));
+
+	return result;
+}
+
+
+static zend_fiber_stream_io_t zend_fiber_hook_write(php_stream *stream, const char *buf, size_t count)
+{
+	zend_fiber_hooked_ops *hooked;
+	php_netstream_data_t *sock;
+	zend_fiber_stream_io_t result;
+	zend_fiber *fiber;
+
+	hooked = (zend_fiber_hooked_ops *) stream->ops;
+	sock = (php_netstream_data_t *) stream->abstract;
+	fiber = zend_fiber_hook_fiber();
+
+	if (fiber != NULL && sock != NULL && sock->is_blocked) {
+		if (!zend_fiber_hook_wait(fiber, sock->socket, ZEND_FIBER_WRITABLE, &sock->timeout, NULL)) {
+			return 0;
+		}
+	}
+
+	ZEND_FIBER_HOOK_CALL(result, stream, hooked, hooked->orig->write(stream, buf, count));
+
+	return result;
+}
+
+
+/* Fibers waiting on the socket are woken up, epoll drops closed fds without reporting an event. */
+static int zend_fiber_hook_close(php_stream *stream, int close_handle)
+{
+	zend_fiber_hooked_ops *hooked;
+	php_netstream_data_t *sock;
+	int result;
+
+	hooked = (zend_fiber_hooked_ops *) stream->ops;
+	sock = (php_netstream_data_t *) stream->abstract;
+
+	if (close_handle && sock != NULL && sock->socket != SOCK_ERR) {
+		zend_fiber_reactor_close(sock->socket);
+	}
+
+	ZEND_FIBER_HOOK_CALL(result, stream, hooked, hooked->orig->close(stream, close_handle));
+
+	return result;
+}
+
+
+static int zend_fiber_hook_set_option(php_stream *stream, int option, int value, void *ptrparam)
+{
+	zend_fiber_hooked_ops *hooked;
+	php_netstream_data_t *sock;
+	php_stream_xport_param *xparam;
+	struct timeval zero;
+	zend_fiber *fiber;
+	socklen_t len;
+	int error;
+	int result;
+
+	hooked = (zend_fiber_hooked_ops *) stream->ops;
+	sock = (php_netstream_data_t *) stream->abstract;
+	fiber = zend_fiber_hook_fiber();
+
+	if (fiber == NULL || option != PHP_STREAM_OPTION_XPORT_API || sock == NULL) {
+		ZEND_FIBER_HOOK_CALL(result, stream, hooked, hooked->orig->set_option(stream, option, value, ptrparam));
+		return result;
+	}
+
+	xparam = (php_stream_xport_param *) ptrparam;
+
+	switch (xparam->op) {
+		case STREAM_XPORT_OP_ACCEPT:
+			/* Let the original accept time out right away if no connection came in. */
+			if (!zend_fiber_hook_wait(fiber, sock->socket, ZEND_FIBER_READABLE, xparam->inputs.timeout, NULL)) {
+				zero.tv_sec = 0;
+				zero.tv_usec = 0;
+
+				xparam->inputs.timeout = &zero;
+			}
+
+			ZEND_FIBER_HOOK_CALL(result, stream, hooked, hooked->orig->set_option(stream, option, value, ptrparam));
+
+			if (xparam->outputs.client != NULL) {
+				zend_fiber_hook_stream(xparam->outputs.client);
+			}
+
+			return result;
+
+		case STREAM_XPORT_OP_CONNECT:
+			xparam->op = STREAM_XPORT_OP_CONNECT_ASYNC;
+
+			ZEND_FIBER_HOOK_CALL(result, stream, hooked, hooked->orig->set_option(stream, option, value, ptrparam));
+
+			xparam->op = STREAM_XPORT_OP_CONNECT;
+
+			/* A return code of 1 signals a connection in progress. */
+			if (result != PHP_STREAM_OPTION_RETURN_OK || xparam->outputs.returncode != 1) {
+				return result;
+			}
+
+			if (!zend_fiber_hook_wait(fiber, sock->socket, ZEND_FIBER_WRITABLE, xparam->inputs.timeout, NULL)) {
+				error = EG(exception) ? EINTR : ETIMEDOUT;
+			} else {
+				error = 0;
+				len = sizeof(error);
+
+				if (getsockopt(sock->socket, SOL_SOCKET, SO_ERROR, (char *) &error, &len) != 0) {
+					error = php_socket_errno();
+				}
+			}
+
+			/* The async connect left the socket in non-blocking mode. */
+			if (sock->is_blocked) {
+				php_set_sock_blocking(sock->socket, 1);
+			}
+
+			xparam->outputs.error_code = error;
+			xparam->outputs.returncode = (error == 0) ? 0 : -1;
+
+			if (error != 0 && xparam->want_errortext) {
+				xparam->outputs.error_text = php_socket_error_str(error);
+			}
+
+			return result;
+
+		default:
+			ZEND_FIBER_HOOK_CALL(result, stream, hooked, hooked->orig->set_option(stream, option, value, ptrparam));
+			return result;
+	}
+}
+
+
+static void zend_fiber_hook_stream(php_stream *stream)
+{
+	zend_fiber_hooked_ops *hooked;
+	const char **label;
+
+	if (stream->ops->label == NULL) {
+		return;
+	}
+
+	for (label = zend_fiber_hooked_labels; *label != NULL; label++) {
+		if (strcmp(stream->ops->label, *label) == 0) {
+			break;
+		}
+	}
+
+	if (*label == NULL) {
+		return;
+	}
+
+	hooked = zend_fiber_hook_ops(stream->ops);
+
+	if (hooked != NULL) {
+		hooked->ops.read = zend_fiber_hook_read;
+		hooked->ops.write = zend_fiber_hook_write;
+		hooked->ops.close = zend_fiber_hook_close;
+		hooked->ops.set_option = zend_fiber_hook_set_option;
+
+		stream->ops = &hooked->ops;
+	}
+}
+
+
+static php_stream *zend_fiber_hook_factory(const char *proto, size_t protolen,
+		const char *resourcename, size_t resourcenamelen,
+		const char *persistent_id, int options, int flags,
+		struct timeval *timeout,
+		php_stream_context *context STREAMS_DC)
+{
+	zend_fiber_hooked_transport *transport;
+	php_stream *stream;
+
+	for (transport = zend_fiber_hooked_transports; transport->name != NULL; transport++) {
+		if (transport->factory != NULL && strlen(transport->name) == protolen && strncmp(transport->name, proto, protolen) == 0) {
+			break;
+		}
+	}
+
+	if (transport->name == NULL) {
+		return NULL;
+	}
+
+	stream = transport->factory(proto, protolen, resourcename, resourcenamelen, persistent_id, options, flags, timeout, context STREAMS_REL_CC);
+
+	if (stream != NULL) {
+		zend_fiber_hook_stream(stream);
+	}
+
+	return stream;
+}
+
+
+static ZEND_NAMED_FUNCTION(zend_fiber_hook_sleep)
+{
+	zend_fiber *fiber;
+	zend_long seconds;
+
+	fiber = zend_fiber_hook_fiber();
+
+	/* Invalid arguments are left to the original function to report. */
+	if (fiber == NULL || zend_parse_parameters_ex(ZEND_PARSE_PARAMS_QUIET, ZEND_NUM_ARGS(), "l", &seconds) == FAILURE || seconds < 0) {
+		zend_fiber_hook_orig_sleep(INTERNAL_FUNCTION_PARAM_PASSTHRU);
+		return;
+	}
+
+	zend_fiber_hook_sleep_for(fiber, (double) seconds);
+
+	RETURN_LONG(0);
+}
+
+
+static ZEND_NAMED_FUNCTION(zend_fiber_hook_usleep)
+{
+	zend_fiber *fiber;
+	zend_long microseconds;
+
+	fiber = zend_fiber_hook_fiber();
+
+	if (fiber == NULL || zend_parse_parameters_ex(ZEND_PARSE_PARAMS_QUIET, ZEND_NUM_ARGS(), "l", &microseconds) == FAILURE || microseconds < 0) {
+		zend_fiber_hook_orig_usleep(INTERNAL_FUNCTION_PARAM_PASSTHRU);
+		return;
+	}
+
+	zend_fiber_hook_sleep_for(fiber, (double) microseconds / 1.0e6);
+}
+
+
+static zif_handler zend_fiber_hook_function(const char *name, zif_handler handler)
+{
+	zend_internal_function *func;
+	zif_handler orig;
+
+	func = zend_hash_str_find_ptr(CG(function_table), name, strlen(name));
+
+	if (func == NULL || func->type != ZEND_INTERNAL_FUNCTION) {
+		return NULL;
+	}
+
+	orig = func->handler;
+	func->handler = handler;
+
+	return orig;
+}
+
+
+static void zend_fiber_unhook_function(const char *name, zif_handler orig)
+{
+	zend_internal_function *func;
+
+	if (orig == NULL) {
+		return;
+	}
+
+	func = zend_hash_str_find_ptr(CG(function_table), name, strlen(name));
+
+	if (func != NULL && func->type == ZEND_INTERNAL_FUNCTION) {
+		func->handler = orig;
+	}
+}
+
+
+void zend_fiber_hook_startup()
+{
+	zend_fiber_hooked_transport *transport;
+	HashTable *transports;
+
+	if (!FIBER_G(hook_blocking)) {
+		return;
+	}
+
+#ifdef ZTS
+	zend_fiber_hooked_ops_mutex = tsrm_mutex_alloc();
+#endif
+
+	transports = php_stream_xport_get_hash();
+
+	for (transport = zend_fiber_hooked_transports; transport->name != NULL; transport++) {
+		transport->factory = (php_stream_transport_factory) zend_hash_str_find_ptr(transports, transport->name, strlen(transport->name));
+
+		if (transport->factory != NULL) {
+			php_stream_xport_register(transport->name, zend_fiber_hook_factory);
+		}
+	}
+
+	zend_fiber_hook_orig_sleep = zend_fiber_hook_function("sleep", zend_fiber_hook_sleep);
+	zend_fiber_hook_orig_usleep = zend_fiber_hook_function("usleep", zend_fiber_hook_usleep);
+}
+
+void zend_fiber_hook_shutdown()
+{
+	zend_fiber_hooked_transport *transport;
+
+	if (!FIBER_G(hook_blocking)) {
+		return;
+	}
+
+	for (transport = zend_fiber_hooked_transports; transport->name != NULL; transport++) {
+		if (transport->factory != NULL) {
+			php_stream_xport_register(transport->name, transport->factory);
+			transport->factory = NULL;
+		}
+	}
+
+	zend_fiber_unhook_function("sleep", zend_fiber_hook_orig_sleep);
+	zend_fiber_unhook_function("usleep", zend_fiber_hook_orig_usleep);
+
+	zend_fiber_hook_orig_sleep = NULL;
+	zend_fiber_hook_orig_usleep = NULL;
+
+#ifdef ZTS
+	tsrm_mutex_free(zend_fiber_hooked_ops_mutex);
+#endif
+}
+
+/*
+ * vim: sw=4 ts=4
+ * vim600: fdm=marker
+ */
@@ -0,0 +1,446 @@
+/*
+  +--------------------------------------------------------------------+
+  | ext-fiber                                                          |
+  +--------------------------------------------------------------------+
+  | Redistribution and use in source and binary forms, with or without |
+  | modification, are permitted provided that the conditions mentioned |
+  | in the accompanying LICENSE file are met.                          |
+  +--------------------------------------------------------------------+
+  | Authors: Martin Schröder <m.schroeder2007@gmail.com>               |
+  |          Aaron Piotrowski <aaron@trowski.com>                      |
+  +--------------------------------------------------------------------+
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "php.h"
+#include "php_network.h"
+#include "zend.h"
+#include "zend_API.h"
+#include "zend_exceptions.h"
+
+#include "php_fiber.h"
+#include "fiber.h"
+#include "fiber_scheduler.h"
+#include "fiber_reactor.h"
+#include "fiber_io.h"
+
+#ifndef PHP_WIN32
+#include <fcntl.h>
+#include <sys/stat.h>
+#endif
+
+#if defined(HAVE_FIBER_IO_URING) && defined(HAVE_SYS_EPOLL_H)
+#define ZEND_FIBER_IO_URING 1
+#include <liburing.h>
+#endif
+
+struct _zend_fiber_io_request {
+	/* Fiber waiting for the operation, NULL once it has stopped waiting. */
+	zend_fiber *fiber;
+
+	/* Buffer referenced by the kernel until the operation has completed. */
+	zend_string *buffer;
+
+	zend_long result;
+	zend_bool done;
+
+	zend_fiber_io_request *prev;
+	zend_fiber_io_request *next;
+};
+
+
+static zend_long zend_fiber_io_syscall(int op, php_socket_t fd, char *buf, size_t length, zend_off_t offset)
+{
+#ifdef PHP_WIN32
+	return -ENOSYS;
+#else
+	ssize_t result;
+
+	switch (op) {
+		case ZEND_FIBER_IO_READ:
+			result = (offset < 0) ? read(fd, buf, length) : pread(fd, buf, length, offset);
+			break;
+		case ZEND_FIBER_IO_WRITE:
+			result = (offset < 0) ? write(fd, buf, length) : pwrite(fd, buf, length, offset);
+			break;
+		case ZEND_FIBER_IO_FSYNC:
+			result = fsync(fd);
+			break;
+		default:
+			errno = EINVAL;
+			result = -1;
+	}
+
+	return (result < 0) ? -errno : (zend_long) result;
+#endif
+}
+
+
+/* Readiness based fallback, fds that support polling are waited for in the reactor before the syscall is made. */
+static zend_long zend_fiber_io_perform_fallback(zend_fiber *fiber, int op, php_socket_t fd, zend_string *buffer, size_t length, zend_off_t offset)
+{
+#ifdef PHP_WIN32
+	return -ENOSYS;
+#else
+	struct stat st;
+	zend_long result;
+	int flags;
+
+	/* Regular files are always ready, fsync cannot be polled for. */
+	if (op == ZEND_FIBER_IO_FSYNC || (fstat(fd, &st) == 0 && S_ISREG(st.st_mode))) {
+		return zend_fiber_io_syscall(op, fd, (buffer != NULL) ? ZSTR_VAL(buffer) : NULL, length, offset);
+	}
+
+	flags = fcntl(fd, F_GETFL);
+
+	if (flags < 0) {
+		return -errno;
+	}
+
+	while (1) {
+		if (!(flags & O_NONBLOCK)) {
+			fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+		}
+
+		result = zend_fiber_io_syscall(op, fd, ZSTR_VAL(buffer), length, offset);
+
+		if (!(flags & O_NONBLOCK)) {
+			fcntl(fd, F_SETFL, flags);
+		}
+
+		if (result != -EAGAIN && result != -EWOULDBLOCK) {
+			return result;
+		}
+
+		if (!zend_fiber_reactor_wait(fiber, fd, (op == ZEND_FIBER_IO_READ) ? ZEND_FIBER_READABLE : ZEND_FIBER_WRITABLE, NULL)) {
+			return -EINTR;
+		}
+	}
+#endif
+}
+
+
+static void zend_fiber_io_request_free(zend_fiber_io_request *request)
+{
+	if (request->buffer != NULL) {
+		zend_string_release(request->buffer);
+	}
+
+	efree(request);
+}
+
+
+#ifdef ZEND_FIBER_IO_URING
+
+static struct io_uring *zend_fiber_io_ring()
+{
+	zend_fiber_io *io;
+	struct io_uring *ring;
+
+	io = &FIBER_G(io);
+
+	if (io->ring != NULL) {
+		return (struct io_uring *) io->ring;
+	}
+
+	if (io->unavailable || FIBER_G(io_uring_entries) <= 0) {
+		return NULL;
+	}
+
+	ring = emalloc(sizeof(struct io_uring));
+
+	/* Fails with old kernels or if io_uring has been disabled by seccomp or sysctl. */
+	if (io_uring_queue_init((unsigned) FIBER_G(io_uring_entries), ring, 0) < 0) {
+		efree(ring);
+		io->unavailable = 1;
+
+		return NULL;
+	}
+
+	/* The reactor waits for the ring fd, it becomes readable when completions are available. */
+	if (!zend_fiber_reactor_watch_completions(ring->ring_fd, zend_fiber_io_reap)) {
+		io_uring_queue_exit(ring);
+		efree(ring);
+		io->unavailable = 1;
+
+		return NULL;
+	}
+
+	io->ring = ring;
+
+	return ring;
+}
+
+static void zend_fiber_io_submit()
+{
+	zend_fiber_io *io;
+
+	io = &FIBER_G(io);
+
+	if (io->queued > 0) {
+		io->queued = 0;
+
+		io_uring_submit((struct io_uring *) io->ring);
+	}
+}
+
+static struct io_uring_sqe *zend_fiber_io_get_sqe(struct io_uring *ring)
+{
+	struct io_uring_sqe *sqe;
+
+	sqe = io_uring_get_sqe(ring);
+
+	if (sqe == NULL) {
+		/* Submission queue is full, flush it early instead of waiting for the end of the tick. */
+		zend_fiber_io_submit();
+
+		sqe = io_uring_get_sqe(ring);
+	}
+
+	return sqe;
+}
+
+static void zend_fiber_io_complete(zend_fiber_io_request *request, zend_long result, zend_bool resume)
+{
+	zend_fiber_io *io;
+
+	io = &FIBER_G(io);
+
+	if (request->prev != NULL) {
+		request->prev->next = request->next;
+	} else {
+		io->requests = request->next;
+	}
+
+	if (request->next != NULL) {
+		request->next->prev = request->prev;
+	}
+
+	io->inflight--;
+
+	if (request->fiber == NULL) {
+		zend_fiber_io_request_free(request);
+		return;
+	}
+
+	request->result = result;
+	request->done = 1;
+
+	if (resume) {
+		zend_fiber_schedule(request->fiber, NULL);
+	}
+}
+
+static void zend_fiber_io_cancel(struct io_uring *ring, zend_fiber_io_request *request)
+{
+	struct io_uring_sqe *sqe;
+
+	sqe = zend_fiber_io_get_sqe(ring);
+
+	if (sqe != NULL) {
+		io_uring_prep_cancel(sqe, request, 0);
+		io_uring_sqe_set_data(sqe, NULL);
+
+		FIBER_G(io).queued++;
+	}
+}
+
+#endif
+
+
+zend_long zend_fiber_io_perform(zend_fiber *fiber, int op, php_socket_t fd, zend_string *buffer, size_t length, zend_off_t offset)
+{
+#ifdef ZEND_FIBER_IO_URING
+	zend_fiber_io *io;
+	zend_fiber_io_request *request;
+	struct io_uring *ring;
+	struct io_uring_sqe *sqe;
+	zend_long result;
+
+	io = &FIBER_G(io);
+	ring = zend_fiber_io_ring();
+
+	if (ring == NULL) {
+		return zend_fiber_io_perform_fallback(fiber, op, fd, buffer, length, offset);
+	}
+
+	sqe = zend_fiber_io_get_sqe(ring);
+
+	if (sqe == NULL) {
+		return zend_fiber_io_perform_fallback(fiber, op, fd, buffer, length, offset);
+	}
+
+	request = emalloc(sizeof(zend_fiber_io_request));
+	memset(request, 0, sizeof(zend_fiber_io_request));
+
+	request->fiber = fiber;
+
+	if (buffer != NULL) {
+		request->buffer = zend_string_copy(buffer);
+	}
+
+	switch (op) {
+		case ZEND_FIBER_IO_READ:
+			io_uring_prep_read(sqe, (int) fd, ZSTR_VAL(buffer), (unsigned) length, (offset < 0) ? (__u64) -1 : (__u64) offset);
+			break;
+		case ZEND_FIBER_IO_WRITE:
+			io_uring_prep_write(sqe, (int) fd, ZSTR_VAL(buffer), (unsigned) length, (offset < 0) ? (__u64) -1 : (__u64) offset);
+			break;
+		default:
+			io_uring_prep_fsync(sqe, (int) fd, 0);
+			break;
+	}
+
+	io_uring_sqe_set_data(sqe, request);
+
+	request->next = io->requests;
+
+	if (io->requests != NULL) {
+		io->requests->prev = request;
+	}
+
+	io->requests = request;
+	io->queued++;
+	io->inflight++;
+
+	/* Submitted with all other operations prepared in this tick once the run queue has been drained. */
+	zend_fiber_park(fiber, NULL);
+
+	if (!request->done) {
+		/* Resumed before the operation completed, the request and its buffer are released on completion. */
+		request->fiber = NULL;
+
+		if (io->ring != NULL) {
+			zend_fiber_io_cancel((struct io_uring *) io->ring, request);
+		}
+
+		return -EINTR;
+	}
+
+	result = request->result;
+
+	zend_fiber_io_request_free(request);
+
+	return result;
+#else
+	return zend_fiber_io_perform_fallback(fiber, op, fd, buffer, length, offset);
+#endif
+}
+
+
+int zend_fiber_io_reap()
+{
+#ifdef ZEND_FIBER_IO_URING
+	struct io_uring *ring;
+	struct io_uring_cqe *cqe;
+	zend_fiber_io_request *request;
+	int count;
+
+	ring = (struct io_uring *) FIBER_G(io).ring;
+	count = 0;
+
+	if (ring == NULL) {
+		return 0;
+	}
+
+	while (io_uring_peek_cqe(ring, &cqe) == 0) {
+		request = (zend_fiber_io_request *) io_uring_cqe_get_data(cqe);
+
+		/* Completions of cancel requests carry no request. */
+		if (request != NULL) {
+			zend_fiber_io_complete(request, (zend_long) cqe->res, 1);
+			count++;
+		}
+
+		io_uring_cqe_seen(ring, cqe);
+	}
+
+	return count;
+#else
+	return 0;
+#endif
+}
+
+
+int zend_fiber_io_flush()
+{
+#ifdef ZEND_FIBER_IO_URING
+	if (FIBER_G(io).ring == NULL) {
+		return 0;
+	}
+
+	zend_fiber_io_submit();
+
+	return zend_fiber_io_reap();
+#else
+	return 0;
+#endif
+}
+
+
+zend_bool zend_fiber_io_pending()
+{
+	return FIBER_G(io).inflight > 0;
+}
+
+
+void zend_fiber_io_startup()
+{
+	zend_fiber_io *io;
+
+	io = &FIBER_G(io);
+
+	io->ring = NULL;
+	io->unavailable = 0;
+	io->queued = 0;
+	io->inflight = 0;
+	io->requests = NULL;
+}
+
+void zend_fiber_io_shutdown()
+{
+#ifdef ZEND_FIBER_IO_URING
+	zend_fiber_io *io;
+	zend_fiber_io_request *request;
+	struct io_uring *ring;
+	struct io_uring_cqe *cqe;
+
+	io = &FIBER_G(io);
+	ring = (struct io_uring *) io->ring;
+
+	if (ring == NULL) {
+		return;
+	}
+
+	/* Buffers must stay alive until the kernel is done with them, cancel everything and wait for it. Waiting
+	 * fibers find their request completed once they are destroyed. */
+	for (request = io->requests; request != NULL; request = request->next) {
+		zend_fiber_io_cancel(ring, request);
+	}
+
+	zend_fiber_io_submit();
+
+	while (io->inflight > 0 && io_uring_wait_cqe(ring, &cqe) == 0) {
+		request = (zend_fiber_io_request *) io_uring_cqe_get_data(cqe);
+
+		if (request != NULL) {
+			zend_fiber_io_complete(request, (zend_long) cqe->res, 0);
+		}
+
+		io_uring_cqe_seen(ring, cqe);
+	}
+
+	io_uring_queue_exit(ring);
+	efree(ring);
+
+	io->ring = NULL;
+#endif
+}
+
+/*
+ * vim: sw=4 ts=4
+ * vim600: fdm=marker
+ */
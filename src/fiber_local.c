@@ -0,0 +1,243 @@
+/*
+  +--------------------------------------------------------------------+
+  | ext-fiber                                                          |
+  +--------------------------------------------------------------------+
+  | Redistribution and use in source and binary forms, with or without |
+  | modification, are permitted provided that the conditions mentioned |
+  | in the accompanying LICENSE file are met.                          |
+  +--------------------------------------------------------------------+
+  | Authors: Martin Schröder <m.schroeder2007@gmail.com>               |
+  |          Aaron Piotrowski <aaron@trowski.com>                      |
+  +--------------------------------------------------------------------+
+*/
+
+#include "php.h"
+#include "zend.h"
+#include "zend_API.h"
+#include "zend_exceptions.h"
+
+#include "php_fiber.h"
+#include "fiber.h"
+#include "fiber_local.h"
+
+static zend_class_entry *zend_ce_fiber_local;
+
+
+static zend_always_inline zend_fiber_locals *zend_fiber_locals_current()
+{
+	zend_fiber *fiber;
+
+	fiber = FIBER_G(current_fiber);
+
+	return (fiber != NULL) ? &fiber->locals : &FIBER_G(locals);
+}
+
+
+static zval *zend_fiber_locals_slot(zend_fiber_locals *locals, uint32_t slot)
+{
+	uint32_t size;
+
+	if (slot >= locals->size) {
+		size = MAX(FIBER_G(local_count), 8);
+
+		locals->slots = safe_erealloc(locals->slots, size, sizeof(zval), 0);
+
+		/* Unused slots are undef. */
+		memset(locals->slots + locals->size, 0, (size - locals->size) * sizeof(zval));
+
+		locals->size = size;
+	}
+
+	return &locals->slots[slot];
+}
+
+
+void zend_fiber_locals_inherit(zend_fiber_locals *locals)
+{
+	zend_fiber_locals *parent;
+	uint32_t i;
+
+	parent = zend_fiber_locals_current();
+
+	if (parent == locals || locals->inherited) {
+		return;
+	}
+
+	locals->inherited = 1;
+
+	for (i = 0; i < parent->size; i++) {
+		if (Z_ISUNDEF(parent->slots[i]) || !(FIBER_G(local_flags)[i] & ZEND_FIBER_LOCAL_INHERIT)) {
+			continue;
+		}
+
+		/* Values set before the fiber has been started take precedence. */
+		if (i < locals->size && !Z_ISUNDEF(locals->slots[i])) {
+			continue;
+		}
+
+		ZVAL_COPY(zend_fiber_locals_slot(locals, i), &parent->slots[i]);
+	}
+}
+
+
+void zend_fiber_locals_destroy(zend_fiber_locals *locals)
+{
+	uint32_t i;
+
+	if (locals->slots == NULL) {
+		return;
+	}
+
+	for (i = 0; i < locals->size; i++) {
+		zval_ptr_dtor(&locals->slots[i]);
+	}
+
+	efree(locals->slots);
+
+	locals->slots = NULL;
+	locals->size = 0;
+}
+
+
+static zend_bool zend_fiber_local_check(zend_long slot)
+{
+	if (UNEXPECTED(slot < 0 || slot >= (zend_long) FIBER_G(local_count))) {
+		zend_throw_error(NULL, "Fiber-local slot " ZEND_LONG_FMT " has not been registered", slot);
+		return 0;
+	}
+
+	return 1;
+}
+
+
+/* {{{ proto int FiberLocal::register(bool $inherit = false) */
+ZEND_METHOD(FiberLocal, register)
+{
+	zend_bool inherit;
+	uint32_t slot;
+
+	inherit = 0;
+
+	ZEND_PARSE_PARAMETERS_START_EX(ZEND_PARSE_PARAMS_THROW, 0, 1)
+		Z_PARAM_OPTIONAL
+		Z_PARAM_BOOL(inherit)
+	ZEND_PARSE_PARAMETERS_END();
+
+	slot = FIBER_G(local_count)++;
+
+	FIBER_G(local_flags) = safe_erealloc(FIBER_G(local_flags), FIBER_G(local_count), sizeof(zend_uchar), 0);
+	FIBER_G(local_flags)[slot] = inherit ? ZEND_FIBER_LOCAL_INHERIT : 0;
+
+	RETURN_LONG((zend_long) slot);
+}
+/* }}} */
+
+
+/* {{{ proto mixed FiberLocal::get(int $slot) */
+ZEND_METHOD(FiberLocal, get)
+{
+	zend_fiber_locals *locals;
+	zend_long slot;
+
+	ZEND_PARSE_PARAMETERS_START_EX(ZEND_PARSE_PARAMS_THROW, 1, 1)
+		Z_PARAM_LONG(slot)
+	ZEND_PARSE_PARAMETERS_END();
+
+	if (!zend_fiber_local_check(slot)) {
+		return;
+	}
+
+	locals = zend_fiber_locals_current();
+
+	if ((uint32_t) slot < locals->size && !Z_ISUNDEF(locals->slots[slot])) {
+		RETURN_ZVAL(&locals->slots[slot], 1, 0);
+	}
+}
+/* }}} */
+
+
+/* {{{ proto void FiberLocal::set(int $slot, mixed $value) */
+ZEND_METHOD(FiberLocal, set)
+{
+	zval *slot_value;
+	zend_long slot;
+	zval *val;
+	zval tmp;
+
+	ZEND_PARSE_PARAMETERS_START_EX(ZEND_PARSE_PARAMS_THROW, 2, 2)
+		Z_PARAM_LONG(slot)
+		Z_PARAM_ZVAL(val)
+	ZEND_PARSE_PARAMETERS_END();
+
+	if (!zend_fiber_local_check(slot)) {
+		return;
+	}
+
+	slot_value = zend_fiber_locals_slot(zend_fiber_locals_current(), (uint32_t) slot);
+
+	/* The old value is released last, its destructor may access the slot. */
+	ZVAL_COPY_VALUE(&tmp, slot_value);
+	ZVAL_COPY(slot_value, val);
+
+	zval_ptr_dtor(&tmp);
+}
+/* }}} */
+
+
+ZEND_BEGIN_ARG_WITH_RETURN_TYPE_INFO_EX(arginfo_fiber_local_register, 0, 0, IS_LONG, 0)
+	ZEND_ARG_TYPE_INFO(0, inherit, _IS_BOOL, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_fiber_local_get, 0, 0, 1)
+	ZEND_ARG_TYPE_INFO(0, slot, IS_LONG, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_WITH_RETURN_TYPE_INFO_EX(arginfo_fiber_local_set, 0, 2, IS_VOID, 0)
+	ZEND_ARG_TYPE_INFO(0, slot, IS_LONG, 0)
+	ZEND_ARG_INFO(0, value)
+ZEND_END_ARG_INFO()
+
+static const zend_function_entry fiber_local_functions[] = {
+	ZEND_ME(FiberLocal, register, arginfo_fiber_local_register, ZEND_ACC_PUBLIC | ZEND_ACC_STATIC)
+	ZEND_ME(FiberLocal, get, arginfo_fiber_local_get, ZEND_ACC_PUBLIC | ZEND_ACC_STATIC)
+	ZEND_ME(FiberLocal, set, arginfo_fiber_local_set, ZEND_ACC_PUBLIC | ZEND_ACC_STATIC)
+	ZEND_FE_END
+};
+
+
+void zend_fiber_local_ce_register()
+{
+	zend_class_entry ce;
+
+	INIT_CLASS_ENTRY(ce, "FiberLocal", fiber_local_functions);
+	zend_ce_fiber_local = zend_register_internal_class(&ce);
+	zend_ce_fiber_local->ce_flags |= ZEND_ACC_FINAL;
+	zend_ce_fiber_local->create_object = NULL;
+	zend_ce_fiber_local->serialize = zend_class_serialize_deny;
+	zend_ce_fiber_local->unserialize = zend_class_unserialize_deny;
+}
+
+void zend_fiber_local_startup()
+{
+	FIBER_G(locals).slots = NULL;
+	FIBER_G(locals).size = 0;
+	FIBER_G(local_count) = 0;
+	FIBER_G(local_flags) = NULL;
+}
+
+void zend_fiber_local_shutdown()
+{
+	zend_fiber_locals_destroy(&FIBER_G(locals));
+
+	if (FIBER_G(local_flags) != NULL) {
+		efree(FIBER_G(local_flags));
+		FIBER_G(local_flags) = NULL;
+	}
+
+	FIBER_G(local_count) = 0;
+}
+
+/*
+ * vim: sw=4 ts=4
+ * vim600: fdm=marker
+ */
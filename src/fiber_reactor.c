@@ -0,0 +1,895 @@
+/*
+  +--------------------------------------------------------------------+
+  | ext-fiber                                                          |
+  +--------------------------------------------------------------------+
+  | Redistribution and use in source and binary forms, with or without |
+  | modification, are permitted provided that the conditions mentioned |
+  | in the accompanying LICENSE file are met.                          |
+  +--------------------------------------------------------------------+
+  | Authors: Martin Schröder <m.schroeder2007@gmail.com>               |
+  |          Aaron Piotrowski <aaron@trowski.com>                      |
+  +--------------------------------------------------------------------+
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "php.h"
+#include "php_network.h"
+#include "zend.h"
+#include "zend_API.h"
+#include "zend_exceptions.h"
+
+#include "php_fiber.h"
+#include "fiber.h"
+#include "fiber_scheduler.h"
+#include "fiber_reactor.h"
+#include "fiber_io.h"
+#include "fiber_thread.h"
+#include "fiber_timer.h"
+
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif
+
+static zend_class_entry *zend_ce_fiber_io;
+
+#define REGISTER_FIBER_IO_CLASS_CONST_LONG(const_name, value) \
+	zend_declare_class_constant_long(zend_ce_fiber_io, const_name, sizeof(const_name)-1, (zend_long)value);
+
+
+static void zend_fiber_watcher_dtor(zval *zv)
+{
+	zend_fiber_watcher *watcher;
+
+	watcher = (zend_fiber_watcher *) Z_PTR_P(zv);
+
+	/* Fibers still waiting are destroyed later on, they must not reference the watcher anymore. */
+	while (zend_fiber_queue_shift(&watcher->waiters) != NULL);
+
+	efree(watcher);
+}
+
+
+#ifdef HAVE_SYS_EPOLL_H
+
+static zend_bool zend_fiber_reactor_backend_init()
+{
+	zend_fiber_reactor *reactor;
+
+	reactor = &FIBER_G(reactor);
+
+	if (reactor->backend_fd >= 0) {
+		return 1;
+	}
+
+	reactor->backend_fd = epoll_create1(EPOLL_CLOEXEC);
+
+	if (reactor->backend_fd < 0) {
+		return 0;
+	}
+
+	reactor->backend_events = emalloc(sizeof(struct epoll_event) * ZEND_FIBER_REACTOR_EVENTS);
+
+	return 1;
+}
+
+static zend_bool zend_fiber_reactor_backend_update(zend_fiber_watcher *watcher, int events)
+{
+	struct epoll_event event;
+	int fd;
+	int op;
+
+	if (!zend_fiber_reactor_backend_init()) {
+		return 0;
+	}
+
+	fd = FIBER_G(reactor).backend_fd;
+
+	if (events == 0) {
+		/* Fails if the fd has been closed in the meantime, epoll has dropped it already. */
+		epoll_ctl(fd, EPOLL_CTL_DEL, (int) watcher->fd, NULL);
+		return 1;
+	}
+
+	memset(&event, 0, sizeof(struct epoll_event));
+
+	event.events = ((events & ZEND_FIBER_READABLE) ? EPOLLIN : 0) | ((events & ZEND_FIBER_WRITABLE) ? EPOLLOUT : 0);
+	event.data.ptr = watcher;
+
+	op = (watcher->events == 0) ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;
+
+	if (epoll_ctl(fd, op, (int) watcher->fd, &event) == 0) {
+		return 1;
+	}
+
+	/* The fd has been closed and reopened or has been registered by a previous watcher. */
+	if (op == EPOLL_CTL_MOD && errno == ENOENT) {
+		return epoll_ctl(fd, EPOLL_CTL_ADD, (int) watcher->fd, &event) == 0;
+	}
+
+	if (op == EPOLL_CTL_ADD && errno == EEXIST) {
+		return epoll_ctl(fd, EPOLL_CTL_MOD, (int) watcher->fd, &event) == 0;
+	}
+
+	return 0;
+}
+
+static void zend_fiber_reactor_dispatch(zend_fiber_watcher *watcher, int ready);
+
+static int zend_fiber_reactor_backend_poll(zend_long timeout)
+{
+	zend_fiber_reactor *reactor;
+	struct epoll_event *events;
+	int ready;
+	int count;
+	int i;
+
+	reactor = &FIBER_G(reactor);
+
+	if (!zend_fiber_reactor_backend_init()) {
+		return -1;
+	}
+
+	events = (struct epoll_event *) reactor->backend_events;
+	count = epoll_wait(reactor->backend_fd, events, ZEND_FIBER_REACTOR_EVENTS, (int) timeout);
+
+	if (count < 0) {
+		return (errno == EINTR) ? 0 : -1;
+	}
+
+	for (i = 0; i < count; i++) {
+		ready = 0;
+
+		/* Errors and hangups are reported to readers and writers, the next syscall surfaces them. */
+		if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+			ready |= ZEND_FIBER_READABLE;
+		}
+
+		if (events[i].events & (EPOLLOUT | EPOLLHUP | EPOLLERR)) {
+			ready |= ZEND_FIBER_WRITABLE;
+		}
+
+		zend_fiber_reactor_dispatch((zend_fiber_watcher *) events[i].data.ptr, ready);
+	}
+
+	return count;
+}
+
+static void zend_fiber_reactor_backend_shutdown()
+{
+	zend_fiber_reactor *reactor;
+
+	reactor = &FIBER_G(reactor);
+
+	if (reactor->backend_fd >= 0) {
+		close(reactor->backend_fd);
+		reactor->backend_fd = -1;
+	}
+
+	if (reactor->backend_events != NULL) {
+		efree(reactor->backend_events);
+		reactor->backend_events = NULL;
+	}
+}
+
+#else
+
+/* Portable fallback, the poll set is rebuilt from the registered watchers on every call. */
+
+static zend_bool zend_fiber_reactor_backend_update(zend_fiber_watcher *watcher, int events)
+{
+	return 1;
+}
+
+static void zend_fiber_reactor_dispatch(zend_fiber_watcher *watcher, int ready);
+
+static int zend_fiber_reactor_backend_poll(zend_long timeout)
+{
+	zend_fiber_reactor *reactor;
+	zend_fiber_watcher **watchers;
+	zend_fiber_watcher *watcher;
+	php_pollfd *fds;
+	uint32_t total;
+	uint32_t count;
+	uint32_t i;
+	int ready;
+	int result;
+
+	reactor = &FIBER_G(reactor);
+	total = reactor->pending + reactor->completions;
+
+	if (total == 0) {
+		if (timeout > 0) {
+			usleep((unsigned int) timeout * 1000);
+		}
+
+		return 0;
+	}
+
+	fds = safe_emalloc(total, sizeof(php_pollfd), 0);
+	watchers = safe_emalloc(total, sizeof(zend_fiber_watcher *), 0);
+	count = 0;
+
+	ZEND_HASH_FOREACH_PTR(&reactor->watchers, watcher) {
+		if (watcher->events == 0 || count == total) {
+			continue;
+		}
+
+		fds[count].fd = watcher->fd;
+		fds[count].events = ((watcher->events & ZEND_FIBER_READABLE) ? POLLIN : 0) | ((watcher->events & ZEND_FIBER_WRITABLE) ? POLLOUT : 0);
+		fds[count].revents = 0;
+
+		watchers[count++] = watcher;
+	} ZEND_HASH_FOREACH_END();
+
+	result = php_poll2(fds, count, (int) timeout);
+
+	if (result > 0) {
+		/* Watchers are collected up front, dispatching may remove them from the table. */
+		for (i = 0; i < count; i++) {
+			ready = 0;
+
+			if (fds[i].revents & (POLLIN | POLLHUP | POLLERR)) {
+				ready |= ZEND_FIBER_READABLE;
+			}
+
+			if (fds[i].revents & (POLLOUT | POLLHUP | POLLERR)) {
+				ready |= ZEND_FIBER_WRITABLE;
+			}
+
+			if (ready != 0) {
+				zend_fiber_reactor_dispatch(watchers[i], ready);
+			}
+		}
+	} else if (result < 0 && php_socket_errno() == EINTR) {
+		result = 0;
+	}
+
+	efree(fds);
+	efree(watchers);
+
+	return result;
+}
+
+static void zend_fiber_reactor_backend_shutdown()
+{
+}
+
+#endif
+
+
+/* Registers the union of the events the waiters are interested in, the watcher is freed once nobody waits. */
+static zend_bool zend_fiber_reactor_update(zend_fiber_watcher *watcher)
+{
+	zend_fiber_reactor *reactor;
+	zend_fiber *fiber;
+	int events;
+
+	reactor = &FIBER_G(reactor);
+	events = 0;
+
+	for (fiber = watcher->waiters.head; fiber != NULL; fiber = fiber->queue_next) {
+		events |= fiber->poll_events;
+	}
+
+	if (events != watcher->events) {
+		if (!zend_fiber_reactor_backend_update(watcher, events)) {
+			return 0;
+		}
+
+		if (watcher->events == 0) {
+			reactor->pending++;
+		} else if (events == 0) {
+			reactor->pending--;
+		}
+
+		watcher->events = events;
+	}
+
+	if (watcher->waiters.head == NULL) {
+		zend_hash_index_del(&reactor->watchers, (zend_ulong) watcher->fd);
+	}
+
+	return 1;
+}
+
+
+static void zend_fiber_reactor_dispatch(zend_fiber_watcher *watcher, int ready)
+{
+	zend_fiber *fiber;
+	zend_fiber *next;
+	zval value;
+
+	if (watcher->reap != NULL) {
+		watcher->reap();
+		return;
+	}
+
+	for (fiber = watcher->waiters.head; fiber != NULL; fiber = next) {
+		next = fiber->queue_next;
+
+		if (fiber->poll_events & ready) {
+			ZVAL_LONG(&value, fiber->poll_events & ready);
+
+			zend_fiber_schedule(fiber, &value);
+		}
+	}
+
+	zend_fiber_reactor_update(watcher);
+}
+
+
+zend_bool zend_fiber_reactor_wait(zend_fiber *fiber, php_socket_t fd, int events, zval *return_value)
+{
+	zend_fiber_reactor *reactor;
+	zend_fiber_watcher *watcher;
+	zend_bool result;
+	zval value;
+	int error;
+
+	reactor = &FIBER_G(reactor);
+
+	if (UNEXPECTED(!reactor->active)) {
+		zend_throw_error(NULL, "Cannot wait for I/O outside of a request");
+		return 0;
+	}
+
+	watcher = zend_hash_index_find_ptr(&reactor->watchers, (zend_ulong) fd);
+
+	if (watcher == NULL) {
+		watcher = emalloc(sizeof(zend_fiber_watcher));
+		memset(watcher, 0, sizeof(zend_fiber_watcher));
+
+		watcher->fd = fd;
+
+		zend_hash_index_add_new_ptr(&reactor->watchers, (zend_ulong) fd, watcher);
+	} else if (UNEXPECTED(watcher->reap != NULL)) {
+		zend_throw_error(NULL, "Cannot wait for I/O on fd %d, it is used by the fiber runtime", (int) fd);
+		return 0;
+	}
+
+	fiber->poll_events = events;
+
+	zend_fiber_queue_push(&watcher->waiters, fiber);
+
+	if (UNEXPECTED(!zend_fiber_reactor_update(watcher))) {
+		error = errno;
+		fiber->poll_events = 0;
+
+		zend_fiber_queue_remove(fiber);
+		zend_fiber_reactor_update(watcher);
+
+		zend_throw_error(NULL, "Failed to register fd %d with the fiber reactor: %s", (int) fd, strerror(error));
+		return 0;
+	}
+
+	ZVAL_NULL(&value);
+
+	result = zend_fiber_park(fiber, &value);
+
+	fiber->poll_events = 0;
+
+	/* Woken up by zend_fiber_reactor_close(). */
+	if (result && Z_TYPE(value) == IS_FALSE) {
+		zend_throw_error(NULL, "Fd %d has been closed while waiting for I/O", (int) fd);
+		return 0;
+	}
+
+	if (return_value != NULL) {
+		ZVAL_COPY_VALUE(return_value, &value);
+	} else {
+		zval_ptr_dtor(&value);
+	}
+
+	/* The fiber has left the wait queue, drop its events (the watcher may be gone already). */
+	if (reactor->active) {
+		watcher = zend_hash_index_find_ptr(&reactor->watchers, (zend_ulong) fd);
+
+		if (watcher != NULL) {
+			zend_fiber_reactor_update(watcher);
+		}
+	}
+
+	return result;
+}
+
+
+void zend_fiber_reactor_close(php_socket_t fd)
+{
+	zend_fiber_reactor *reactor;
+	zend_fiber_watcher *watcher;
+	zend_fiber *fiber;
+	zval value;
+
+	reactor = &FIBER_G(reactor);
+
+	if (!reactor->active) {
+		return;
+	}
+
+	watcher = zend_hash_index_find_ptr(&reactor->watchers, (zend_ulong) fd);
+
+	if (watcher == NULL || watcher->reap != NULL) {
+		return;
+	}
+
+	ZVAL_FALSE(&value);
+
+	/* Scheduling a fiber removes it from the wait queue. */
+	while ((fiber = watcher->waiters.head) != NULL) {
+		zend_fiber_schedule(fiber, &value);
+	}
+
+	/* Unregisters the fd while it is still open and frees the watcher. */
+	zend_fiber_reactor_update(watcher);
+}
+
+
+zend_bool zend_fiber_reactor_watch_completions(php_socket_t fd, zend_fiber_reap_func reap)
+{
+	zend_fiber_reactor *reactor;
+	zend_fiber_watcher *watcher;
+
+	reactor = &FIBER_G(reactor);
+
+	if (!reactor->active || zend_hash_index_exists(&reactor->watchers, (zend_ulong) fd)) {
+		return 0;
+	}
+
+	watcher = emalloc(sizeof(zend_fiber_watcher));
+	memset(watcher, 0, sizeof(zend_fiber_watcher));
+
+	watcher->fd = fd;
+	watcher->reap = reap;
+
+	if (!zend_fiber_reactor_backend_update(watcher, ZEND_FIBER_READABLE)) {
+		efree(watcher);
+		return 0;
+	}
+
+	/* Stays registered until the end of the request, fibers never wait on it directly. */
+	watcher->events = ZEND_FIBER_READABLE;
+
+	zend_hash_index_add_new_ptr(&reactor->watchers, (zend_ulong) fd, watcher);
+
+	reactor->completions++;
+
+	return 1;
+}
+
+
+void zend_fiber_reactor_unwatch_completions(php_socket_t fd)
+{
+	zend_fiber_reactor *reactor;
+	zend_fiber_watcher *watcher;
+
+	reactor = &FIBER_G(reactor);
+
+	if (!reactor->active) {
+		return;
+	}
+
+	watcher = zend_hash_index_find_ptr(&reactor->watchers, (zend_ulong) fd);
+
+	if (watcher == NULL || watcher->reap == NULL) {
+		return;
+	}
+
+	zend_fiber_reactor_backend_update(watcher, 0);
+
+	reactor->completions--;
+
+	zend_hash_index_del(&reactor->watchers, (zend_ulong) fd);
+}
+
+
+void zend_fiber_reactor_fork()
+{
+#ifdef HAVE_SYS_EPOLL_H
+	zend_fiber_reactor *reactor;
+	zend_fiber_watcher *watcher;
+
+	reactor = &FIBER_G(reactor);
+
+	if (!reactor->active || reactor->backend_fd < 0) {
+		return;
+	}
+
+	/* Closing the inherited fd leaves the registrations of the parent alone, they belong to the same instance. */
+	close(reactor->backend_fd);
+	efree(reactor->backend_events);
+
+	reactor->backend_fd = -1;
+	reactor->backend_events = NULL;
+
+	/* The new instance is created by the first registration, MOD fails with ENOENT and falls back to ADD. */
+	ZEND_HASH_FOREACH_PTR(&reactor->watchers, watcher) {
+		if (watcher->events != 0) {
+			zend_fiber_reactor_backend_update(watcher, watcher->events);
+		}
+	} ZEND_HASH_FOREACH_END();
+#endif
+}
+
+
+zend_bool zend_fiber_reactor_pending()
+{
+	return FIBER_G(reactor).pending > 0 || zend_fiber_io_pending() || zend_fiber_tasks_pending();
+}
+
+
+int zend_fiber_reactor_poll(zend_long timeout)
+{
+	int completed;
+	int result;
+
+	if (!FIBER_G(reactor).active) {
+		return 0;
+	}
+
+	/* Operations prepared by fibers during this tick are submitted in a single batch. */
+	completed = zend_fiber_io_flush();
+
+	if (completed > 0) {
+		timeout = 0;
+	}
+
+	/* Without anything to wait for the backend is only used to sleep until the next timer is due. */
+	if (!zend_fiber_reactor_pending() && timeout <= 0) {
+		return completed;
+	}
+
+	result = zend_fiber_reactor_backend_poll(timeout);
+
+	return (result < 0) ? result : result + completed;
+}
+
+
+/* Returns the fd of a stream resource or an int, throws and returns -1 if there is none. */
+static php_socket_t zend_fiber_reactor_get_fd(zval *val, php_stream **stream)
+{
+	php_socket_t fd;
+
+	*stream = NULL;
+
+	if (Z_TYPE_P(val) == IS_LONG) {
+		fd = (php_socket_t) Z_LVAL_P(val);
+	} else if (Z_TYPE_P(val) == IS_RESOURCE) {
+		php_stream_from_zval_no_verify(*stream, val);
+
+		if (*stream == NULL) {
+			zend_throw_error(NULL, "Expected a stream resource");
+			return -1;
+		}
+
+		if (php_stream_cast(*stream, PHP_STREAM_AS_FD_FOR_SELECT | PHP_STREAM_CAST_INTERNAL, (void *) &fd, 1) != SUCCESS) {
+			zend_throw_error(NULL, "Cannot perform I/O on a stream that has no file descriptor");
+			return -1;
+		}
+	} else {
+		zend_throw_error(NULL, "Expected a stream resource or a file descriptor");
+		return -1;
+	}
+
+	if (UNEXPECTED(fd < 0)) {
+		zend_throw_error(NULL, "Invalid file descriptor");
+		return -1;
+	}
+
+	return fd;
+}
+
+
+/* {{{ proto int FiberIO::poll(resource|int $stream, int $events [, ?float $timeout]) */
+ZEND_METHOD(FiberIO, poll)
+{
+	zend_fiber *fiber;
+	php_stream *stream;
+	php_socket_t fd;
+	zend_long events;
+	double timeout;
+	zend_bool timeout_null;
+	zval *val;
+
+	timeout = 0;
+	timeout_null = 1;
+
+	ZEND_PARSE_PARAMETERS_START_EX(ZEND_PARSE_PARAMS_THROW, 2, 3)
+		Z_PARAM_ZVAL(val)
+		Z_PARAM_LONG(events)
+		Z_PARAM_OPTIONAL
+		Z_PARAM_DOUBLE_EX(timeout, timeout_null, 1, 0)
+	ZEND_PARSE_PARAMETERS_END();
+
+	fiber = FIBER_G(current_fiber);
+
+	if (UNEXPECTED(fiber == NULL)) {
+		zend_throw_error(NULL, "Cannot wait for I/O from outside a fiber");
+		return;
+	}
+
+	events &= ZEND_FIBER_READABLE | ZEND_FIBER_WRITABLE;
+
+	if (events == 0) {
+		zend_throw_error(NULL, "At least one of FiberIO::READABLE and FiberIO::WRITABLE must be given");
+		return;
+	}
+
+	fd = zend_fiber_reactor_get_fd(val, &stream);
+
+	if (fd < 0) {
+		return;
+	}
+
+	/* Buffered data can be read without waiting, stream_select() behaves the same way. */
+	if (stream != NULL && (events & ZEND_FIBER_READABLE) && stream->writepos - stream->readpos > 0) {
+		RETURN_LONG(ZEND_FIBER_READABLE);
+	}
+
+	if (!timeout_null) {
+		zend_fiber_timer_start(&fiber->timer, zend_fiber_timer_deadline(timeout), zend_fiber_wakeup);
+	}
+
+	if (!zend_fiber_reactor_wait(fiber, fd, (int) events, return_value)) {
+		zend_fiber_timer_stop(&fiber->timer);
+		return;
+	}
+
+	zend_fiber_timer_stop(&fiber->timer);
+
+	/* Woken up by the timer, none of the events occurred. */
+	if (Z_TYPE_P(return_value) != IS_LONG) {
+		RETURN_LONG(0);
+	}
+}
+/* }}} */
+
+
+/* {{{ proto string FiberIO::read(resource|int $stream, int $length [, ?int $offset]) */
+ZEND_METHOD(FiberIO, read)
+{
+	zend_fiber *fiber;
+	php_stream *stream;
+	php_socket_t fd;
+	zend_string *buffer;
+	zend_long length;
+	zend_long offset;
+	zend_bool offset_null;
+	zend_long result;
+	size_t buffered;
+	zval *val;
+
+	offset = -1;
+	offset_null = 1;
+
+	ZEND_PARSE_PARAMETERS_START_EX(ZEND_PARSE_PARAMS_THROW, 2, 3)
+		Z_PARAM_ZVAL(val)
+		Z_PARAM_LONG(length)
+		Z_PARAM_OPTIONAL
+		Z_PARAM_LONG_EX(offset, offset_null, 1, 0)
+	ZEND_PARSE_PARAMETERS_END();
+
+	fiber = FIBER_G(current_fiber);
+
+	if (UNEXPECTED(fiber == NULL)) {
+		zend_throw_error(NULL, "Cannot perform I/O from outside a fiber");
+		return;
+	}
+
+	if (length <= 0) {
+		zend_throw_error(NULL, "Length must be greater than 0");
+		return;
+	}
+
+	fd = zend_fiber_reactor_get_fd(val, &stream);
+
+	if (fd < 0) {
+		return;
+	}
+
+	buffer = zend_string_alloc((size_t) length, 0);
+
+	/* Data buffered by the stream layer has already been consumed from the fd. */
+	if (stream != NULL && offset_null && stream->writepos - stream->readpos > 0) {
+		buffered = (size_t) (stream->writepos - stream->readpos);
+		result = (zend_long) php_stream_read(stream, ZSTR_VAL(buffer), MIN(buffered, (size_t) length));
+	} else {
+		result = zend_fiber_io_perform(fiber, ZEND_FIBER_IO_READ, fd, buffer, (size_t) length, offset_null ? -1 : (zend_off_t) offset);
+	}
+
+	if (result < 0) {
+		zend_string_release(buffer);
+
+		if (!EG(exception)) {
+			zend_throw_error(NULL, "Read from fd %d failed: %s", (int) fd, strerror((int) -result));
+		}
+
+		return;
+	}
+
+	if (result < length) {
+		buffer = zend_string_truncate(buffer, (size_t) result, 0);
+	}
+
+	ZSTR_VAL(buffer)[result] = '\0';
+
+	RETURN_NEW_STR(buffer);
+}
+/* }}} */
+
+
+/* {{{ proto int FiberIO::write(resource|int $stream, string $data [, ?int $offset]) */
+ZEND_METHOD(FiberIO, write)
+{
+	zend_fiber *fiber;
+	php_stream *stream;
+	php_socket_t fd;
+	zend_string *data;
+	zend_long offset;
+	zend_bool offset_null;
+	zend_long result;
+	zval *val;
+
+	offset = -1;
+	offset_null = 1;
+
+	ZEND_PARSE_PARAMETERS_START_EX(ZEND_PARSE_PARAMS_THROW, 2, 3)
+		Z_PARAM_ZVAL(val)
+		Z_PARAM_STR(data)
+		Z_PARAM_OPTIONAL
+		Z_PARAM_LONG_EX(offset, offset_null, 1, 0)
+	ZEND_PARSE_PARAMETERS_END();
+
+	fiber = FIBER_G(current_fiber);
+
+	if (UNEXPECTED(fiber == NULL)) {
+		zend_throw_error(NULL, "Cannot perform I/O from outside a fiber");
+		return;
+	}
+
+	fd = zend_fiber_reactor_get_fd(val, &stream);
+
+	if (fd < 0) {
+		return;
+	}
+
+	if (ZSTR_LEN(data) == 0) {
+		RETURN_LONG(0);
+	}
+
+	result = zend_fiber_io_perform(fiber, ZEND_FIBER_IO_WRITE, fd, data, ZSTR_LEN(data), offset_null ? -1 : (zend_off_t) offset);
+
+	if (result < 0) {
+		if (!EG(exception)) {
+			zend_throw_error(NULL, "Write to fd %d failed: %s", (int) fd, strerror((int) -result));
+		}
+
+		return;
+	}
+
+	RETURN_LONG(result);
+}
+/* }}} */
+
+
+/* {{{ proto void FiberIO::fsync(resource|int $stream) */
+ZEND_METHOD(FiberIO, fsync)
+{
+	zend_fiber *fiber;
+	php_stream *stream;
+	php_socket_t fd;
+	zend_long result;
+	zval *val;
+
+	ZEND_PARSE_PARAMETERS_START_EX(ZEND_PARSE_PARAMS_THROW, 1, 1)
+		Z_PARAM_ZVAL(val)
+	ZEND_PARSE_PARAMETERS_END();
+
+	fiber = FIBER_G(current_fiber);
+
+	if (UNEXPECTED(fiber == NULL)) {
+		zend_throw_error(NULL, "Cannot perform I/O from outside a fiber");
+		return;
+	}
+
+	fd = zend_fiber_reactor_get_fd(val, &stream);
+
+	if (fd < 0) {
+		return;
+	}
+
+	result = zend_fiber_io_perform(fiber, ZEND_FIBER_IO_FSYNC, fd, NULL, 0, -1);
+
+	if (result < 0 && !EG(exception)) {
+		zend_throw_error(NULL, "Syncing fd %d failed: %s", (int) fd, strerror((int) -result));
+	}
+}
+/* }}} */
+
+
+ZEND_BEGIN_ARG_WITH_RETURN_TYPE_INFO_EX(arginfo_fiber_io_poll, 0, 2, IS_LONG, 0)
+	ZEND_ARG_INFO(0, stream)
+	ZEND_ARG_TYPE_INFO(0, events, IS_LONG, 0)
+	ZEND_ARG_TYPE_INFO(0, timeout, IS_DOUBLE, 1)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_WITH_RETURN_TYPE_INFO_EX(arginfo_fiber_io_read, 0, 2, IS_STRING, 0)
+	ZEND_ARG_INFO(0, stream)
+	ZEND_ARG_TYPE_INFO(0, length, IS_LONG, 0)
+	ZEND_ARG_TYPE_INFO(0, offset, IS_LONG, 1)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_WITH_RETURN_TYPE_INFO_EX(arginfo_fiber_io_write, 0, 2, IS_LONG, 0)
+	ZEND_ARG_INFO(0, stream)
+	ZEND_ARG_TYPE_INFO(0, data, IS_STRING, 0)
+	ZEND_ARG_TYPE_INFO(0, offset, IS_LONG, 1)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_WITH_RETURN_TYPE_INFO_EX(arginfo_fiber_io_fsync, 0, 1, IS_VOID, 0)
+	ZEND_ARG_INFO(0, stream)
+ZEND_END_ARG_INFO()
+
+static const zend_function_entry fiber_io_functions[] = {
+	ZEND_ME(FiberIO, poll, arginfo_fiber_io_poll, ZEND_ACC_PUBLIC | ZEND_ACC_STATIC)
+	ZEND_ME(FiberIO, read, arginfo_fiber_io_read, ZEND_ACC_PUBLIC | ZEND_ACC_STATIC)
+	ZEND_ME(FiberIO, write, arginfo_fiber_io_write, ZEND_ACC_PUBLIC | ZEND_ACC_STATIC)
+	ZEND_ME(FiberIO, fsync, arginfo_fiber_io_fsync, ZEND_ACC_PUBLIC | ZEND_ACC_STATIC)
+	ZEND_FE_END
+};
+
+
+void zend_fiber_reactor_ce_register()
+{
+	zend_class_entry ce;
+
+	INIT_CLASS_ENTRY(ce, "FiberIO", fiber_io_functions);
+	zend_ce_fiber_io = zend_register_internal_class(&ce);
+	zend_ce_fiber_io->ce_flags |= ZEND_ACC_FINAL;
+	zend_ce_fiber_io->create_object = NULL;
+	zend_ce_fiber_io->serialize = zend_class_serialize_deny;
+	zend_ce_fiber_io->unserialize = zend_class_unserialize_deny;
+
+	REGISTER_FIBER_IO_CLASS_CONST_LONG("READABLE", ZEND_FIBER_READABLE);
+	REGISTER_FIBER_IO_CLASS_CONST_LONG("WRITABLE", ZEND_FIBER_WRITABLE);
+}
+
+void zend_fiber_reactor_startup()
+{
+	zend_fiber_reactor *reactor;
+
+	reactor = &FIBER_G(reactor);
+
+	zend_hash_init(&reactor->watchers, 8, NULL, zend_fiber_watcher_dtor, 0);
+
+	reactor->pending = 0;
+	reactor->completions = 0;
+	reactor->backend_fd = -1;
+	reactor->backend_events = NULL;
+	reactor->active = 1;
+}
+
+void zend_fiber_reactor_shutdown()
+{
+	zend_fiber_reactor *reactor;
+
+	reactor = &FIBER_G(reactor);
+
+	if (!reactor->active) {
+		return;
+	}
+
+	reactor->active = 0;
+	reactor->pending = 0;
+	reactor->completions = 0;
+
+	zend_hash_destroy(&reactor->watchers);
+
+	zend_fiber_reactor_backend_shutdown();
+}
+
+/*
+ * vim: sw=4 ts=4
+ * vim600: fdm=marker
+ */
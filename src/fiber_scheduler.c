@@ -0,0 +1,372 @@
+/*
+  +--------------------------------------------------------------------+
+  | ext-fiber                                                          |
+  +--------------------------------------------------------------------+
+  | Redistribution and use in source and binary forms, with or without |
+  | modification, are permitted provided that the conditions mentioned |
+  | in the accompanying LICENSE file are met.                          |
+  +--------------------------------------------------------------------+
+  | Authors: Martin Schröder <m.schroeder2007@gmail.com>               |
+  |          Aaron Piotrowski <aaron@trowski.com>                      |
+  +--------------------------------------------------------------------+
+*/
+
+#include "php.h"
+#include "zend.h"
+#include "zend_API.h"
+#include "zend_exceptions.h"
+
+#include "php_fiber.h"
+#include "fiber.h"
+#include "fiber_scheduler.h"
+#include "fiber_cancellation.h"
+#include "fiber_reactor.h"
+#include "fiber_timer.h"
+
+#ifndef ZEND_PARSE_PARAMETERS_NONE
+#define ZEND_PARSE_PARAMETERS_NONE() zend_parse_parameters_none()
+#endif
+
+static zend_class_entry *zend_ce_fiber_scheduler;
+
+
+void zend_fiber_queue_push(zend_fiber_queue *queue, zend_fiber *fiber)
+{
+	ZEND_ASSERT(fiber->queue == NULL);
+
+	fiber->queue = queue;
+	fiber->queue_prev = queue->tail;
+	fiber->queue_next = NULL;
+
+	if (queue->tail != NULL) {
+		queue->tail->queue_next = fiber;
+	} else {
+		queue->head = fiber;
+	}
+
+	queue->tail = fiber;
+	queue->size++;
+}
+
+
+zend_fiber *zend_fiber_queue_shift(zend_fiber_queue *queue)
+{
+	zend_fiber *fiber;
+
+	fiber = queue->head;
+
+	if (fiber != NULL) {
+		zend_fiber_queue_remove(fiber);
+	}
+
+	return fiber;
+}
+
+
+void zend_fiber_queue_remove(zend_fiber *fiber)
+{
+	zend_fiber_queue *queue;
+
+	queue = fiber->queue;
+
+	if (queue == NULL) {
+		return;
+	}
+
+	if (fiber->queue_prev != NULL) {
+		fiber->queue_prev->queue_next = fiber->queue_next;
+	} else {
+		queue->head = fiber->queue_next;
+	}
+
+	if (fiber->queue_next != NULL) {
+		fiber->queue_next->queue_prev = fiber->queue_prev;
+	} else {
+		queue->tail = fiber->queue_prev;
+	}
+
+	queue->size--;
+
+	fiber->queue = NULL;
+	fiber->queue_prev = NULL;
+	fiber->queue_next = NULL;
+}
+
+
+uint32_t zend_fiber_queue_gc(zend_fiber_queue *queue, zval **buffer, uint32_t *size, uint32_t count)
+{
+	zend_fiber *fiber;
+
+	for (fiber = queue->head; fiber != NULL; fiber = fiber->queue_next) {
+		/* The reference reported is the one the fiber holds on itself while it is parked. */
+		if (!fiber->attached) {
+			continue;
+		}
+
+		if (count == *size) {
+			*size = (*size == 0) ? 8 : *size * 2;
+			*buffer = safe_erealloc(*buffer, *size, sizeof(zval), 0);
+		}
+
+		ZVAL_OBJ(&(*buffer)[count++], &fiber->std);
+	}
+
+	return count;
+}
+
+
+void zend_fiber_attach(zend_fiber *fiber)
+{
+	/* Released by the caller of the fiber once it terminates or suspends itself. */
+	if (!fiber->attached) {
+		fiber->attached = 1;
+		GC_ADDREF(&fiber->std);
+	}
+}
+
+
+void zend_fiber_schedule(zend_fiber *fiber, zval *value)
+{
+	zend_fiber_queue_remove(fiber);
+
+	zval_ptr_dtor(&fiber->send);
+
+	if (value != NULL) {
+		ZVAL_COPY(&fiber->send, value);
+	} else {
+		ZVAL_UNDEF(&fiber->send);
+	}
+
+	zend_fiber_attach(fiber);
+	zend_fiber_queue_push(&FIBER_G(run_queue), fiber);
+}
+
+
+zend_bool zend_fiber_park(zend_fiber *fiber, zval *return_value)
+{
+	zend_fiber *next;
+	zend_bool result;
+	zval value;
+
+	/* A cancelled fiber does not start waiting, it leaves the queue it has just been linked into. */
+	if (UNEXPECTED(!zend_fiber_cancellation_check(fiber))) {
+		zend_fiber_queue_remove(fiber);
+		return 0;
+	}
+
+	zend_fiber_attach(fiber);
+
+	fiber->parked = 1;
+
+	next = zend_fiber_queue_shift(&FIBER_G(run_queue));
+
+	if (next == NULL) {
+		result = zend_fiber_pause(fiber, NULL, return_value);
+	} else {
+		/* Switch to the next runnable fiber without a round trip through the run loop. */
+		ZVAL_COPY_VALUE(&value, &next->send);
+		ZVAL_UNDEF(&next->send);
+
+		result = zend_fiber_transfer(fiber, next, Z_ISUNDEF(value) ? NULL : &value, return_value);
+
+		zval_ptr_dtor(&value);
+	}
+
+	fiber->parked = 0;
+
+	if (result && UNEXPECTED(!zend_fiber_cancellation_check(fiber))) {
+		return 0;
+	}
+
+	return result;
+}
+
+
+void zend_fiber_notify_awaiters(zend_fiber *fiber)
+{
+	zend_fiber *awaiter;
+
+	while ((awaiter = zend_fiber_queue_shift(&fiber->awaiters)) != NULL) {
+		zend_fiber_schedule(awaiter, NULL);
+	}
+}
+
+
+void zend_fiber_wakeup(zend_fiber_timer *timer)
+{
+	zend_fiber *fiber;
+
+	fiber = ZEND_FIBER_FROM_TIMER(timer);
+
+	/* Already woken up in the same tick (e.g. by the reactor), its wakeup value must be kept. */
+	if (fiber->queue == &FIBER_G(run_queue)) {
+		return;
+	}
+
+	zend_fiber_schedule(fiber, NULL);
+}
+
+
+/* {{{ proto void FiberScheduler::schedule(Fiber $fiber [, mixed $value]) */
+ZEND_METHOD(FiberScheduler, schedule)
+{
+	zend_fiber *fiber;
+	zval *obj;
+	zval *val;
+
+	val = NULL;
+
+	ZEND_PARSE_PARAMETERS_START_EX(ZEND_PARSE_PARAMS_THROW, 1, 2)
+		Z_PARAM_OBJECT_OF_CLASS(obj, zend_ce_fiber)
+		Z_PARAM_OPTIONAL
+		Z_PARAM_ZVAL(val)
+	ZEND_PARSE_PARAMETERS_END();
+
+	fiber = (zend_fiber *) Z_OBJ_P(obj);
+
+	if (fiber->status != ZEND_FIBER_STATUS_INIT && fiber->status != ZEND_FIBER_STATUS_SUSPENDED) {
+		zend_throw_error(NULL, "Only fibers that are not running and have not terminated can be scheduled");
+		return;
+	}
+
+	if (fiber->queue != NULL) {
+		zend_throw_error(NULL, "Fiber is already scheduled or waiting");
+		return;
+	}
+
+	/* The scheduling fiber counts as the one starting it. */
+	if (fiber->status == ZEND_FIBER_STATUS_INIT) {
+		if (FIBER_G(current_fiber) != NULL) {
+			zend_fiber_cancellation_inherit(fiber, FIBER_G(current_fiber));
+		}
+
+		zend_fiber_locals_inherit(&fiber->locals);
+	}
+
+	zend_fiber_schedule(fiber, val);
+}
+/* }}} */
+
+
+static void zend_fiber_scheduler_run_fiber(zend_fiber *fiber)
+{
+	zval value;
+
+	ZVAL_COPY_VALUE(&value, &fiber->send);
+	ZVAL_UNDEF(&fiber->send);
+
+	if (fiber->status == ZEND_FIBER_STATUS_INIT) {
+		if (Z_ISUNDEF(value)) {
+			zend_fiber_start(fiber, NULL, 0, NULL);
+		} else {
+			zend_fiber_start(fiber, &value, 1, NULL);
+		}
+	} else if (fiber->status == ZEND_FIBER_STATUS_SUSPENDED) {
+		zend_fiber_resume(fiber, Z_ISUNDEF(value) ? NULL : &value, NULL);
+	}
+
+	zval_ptr_dtor(&value);
+}
+
+
+/* {{{ proto void FiberScheduler::run() */
+ZEND_METHOD(FiberScheduler, run)
+{
+	zend_fiber *fiber;
+	zend_long timeout;
+	uint32_t count;
+
+	ZEND_PARSE_PARAMETERS_NONE();
+
+	if (UNEXPECTED(FIBER_G(current_fiber) != NULL)) {
+		zend_throw_error(NULL, "Cannot run the scheduler from within a fiber");
+		return;
+	}
+
+	if (UNEXPECTED(FIBER_G(scheduler_running))) {
+		zend_throw_error(NULL, "Scheduler is already running");
+		return;
+	}
+
+	FIBER_G(scheduler_running) = 1;
+
+	while (!EG(exception)) {
+		count = FIBER_G(run_queue).size;
+
+		if (count == 0) {
+			timeout = zend_fiber_timer_timeout();
+
+			/* Block only if some fiber is waiting for I/O or a timer, otherwise there is nothing left to do. */
+			if (timeout < 0 && !zend_fiber_reactor_pending()) {
+				break;
+			}
+
+			zend_fiber_reactor_poll(timeout);
+			zend_fiber_timer_advance();
+			continue;
+		}
+
+		/* Fibers scheduled while running this tick are run in the next one, after I/O has been polled. */
+		while (count-- > 0 && (fiber = zend_fiber_queue_shift(&FIBER_G(run_queue))) != NULL) {
+			zend_fiber_scheduler_run_fiber(fiber);
+
+			/* Uncaught exceptions of fibers are thrown from run(). */
+			if (EG(exception)) {
+				break;
+			}
+		}
+
+		if (!EG(exception)) {
+			if (zend_fiber_reactor_pending()) {
+				zend_fiber_reactor_poll(0);
+			}
+
+			zend_fiber_timer_advance();
+		}
+	}
+
+	FIBER_G(scheduler_running) = 0;
+}
+/* }}} */
+
+
+ZEND_BEGIN_ARG_WITH_RETURN_TYPE_INFO_EX(arginfo_fiber_scheduler_schedule, 0, 1, IS_VOID, 0)
+	ZEND_ARG_OBJ_INFO(0, fiber, Fiber, 0)
+	ZEND_ARG_INFO(0, value)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_WITH_RETURN_TYPE_INFO_EX(arginfo_fiber_scheduler_run, 0, 0, IS_VOID, 0)
+ZEND_END_ARG_INFO()
+
+static const zend_function_entry fiber_scheduler_functions[] = {
+	ZEND_ME(FiberScheduler, schedule, arginfo_fiber_scheduler_schedule, ZEND_ACC_PUBLIC | ZEND_ACC_STATIC)
+	ZEND_ME(FiberScheduler, run, arginfo_fiber_scheduler_run, ZEND_ACC_PUBLIC | ZEND_ACC_STATIC)
+	ZEND_FE_END
+};
+
+
+void zend_fiber_scheduler_ce_register()
+{
+	zend_class_entry ce;
+
+	INIT_CLASS_ENTRY(ce, "FiberScheduler", fiber_scheduler_functions);
+	zend_ce_fiber_scheduler = zend_register_internal_class(&ce);
+	zend_ce_fiber_scheduler->ce_flags |= ZEND_ACC_FINAL;
+	zend_ce_fiber_scheduler->create_object = NULL;
+	zend_ce_fiber_scheduler->serialize = zend_class_serialize_deny;
+	zend_ce_fiber_scheduler->unserialize = zend_class_unserialize_deny;
+}
+
+void zend_fiber_scheduler_startup()
+{
+	FIBER_G(run_queue).head = NULL;
+	FIBER_G(run_queue).tail = NULL;
+	FIBER_G(run_queue).size = 0;
+	FIBER_G(scheduler_running) = 0;
+	FIBER_G(released) = NULL;
+}
+
+/*
+ * vim: sw=4 ts=4
+ * vim600: fdm=marker
+ */
@@ -21,9 +21,150 @@
 #include "php.h"
 #include "zend.h"
 
+#include "php_fiber.h"
 #include "fiber_stack.h"
 
-zend_bool zend_fiber_stack_allocate(zend_fiber_stack *stack, unsigned int size)
+typedef struct _zend_fiber_stack_pool_entry zend_fiber_stack_pool_entry;
+
+/* Placed at the top of a pooled stack, links it into the stack pool. */
+struct _zend_fiber_stack_pool_entry {
+	zend_fiber_stack_pool_entry *next;
+	zend_fiber_stack stack;
+};
+
+/* Pattern written to every word of a painted stack, words still holding it have never been touched. */
+#define ZEND_FIBER_STACK_CANARY ((uintptr_t) 0x5ca1ab1e5ca1ab1eULL)
+
+static void zend_fiber_stack_release(zend_fiber_stack *stack);
+
+static void zend_fiber_stack_paint(zend_fiber_stack *stack)
+{
+	uintptr_t *pos;
+	uintptr_t *end;
+
+	pos = (uintptr_t *) stack->pointer;
+	end = (uintptr_t *) ((char *) stack->pointer + stack->size);
+
+	while (pos < end) {
+		*pos++ = ZEND_FIBER_STACK_CANARY;
+	}
+}
+
+static void zend_fiber_stack_record_usage(size_t usage)
+{
+	int bucket;
+
+	bucket = 0;
+
+	while ((usage >> (bucket + 1)) && bucket < ZEND_FIBER_STACK_USAGE_BUCKETS - 1) {
+		bucket++;
+	}
+
+	FIBER_G(stack_usage_histogram)[bucket]++;
+	FIBER_G(stack_usage_samples)++;
+
+	if (usage > FIBER_G(stack_usage_peak)) {
+		FIBER_G(stack_usage_peak) = usage;
+	}
+}
+
+size_t zend_fiber_stack_measure(zend_fiber_stack *stack)
+{
+	uintptr_t *pos;
+	uintptr_t *end;
+
+	if (!stack->watermark || stack->pointer == NULL) {
+		return 0;
+	}
+
+	pos = (uintptr_t *) stack->pointer;
+	end = (uintptr_t *) ((char *) stack->pointer + stack->size);
+
+	while (pos < end && *pos == ZEND_FIBER_STACK_CANARY) {
+		pos++;
+	}
+
+	return (char *) end - (char *) pos;
+}
+
+static zend_bool zend_fiber_stack_pool_take(zend_fiber_stack *stack)
+{
+	zend_fiber_stack_pool_entry *entry;
+	zend_fiber_stack_pool_entry **prev;
+
+	prev = (zend_fiber_stack_pool_entry **) &FIBER_G(stack_pool);
+
+	for (entry = *prev; entry != NULL; prev = &entry->next, entry = entry->next) {
+		if (entry->stack.size == stack->size) {
+			*prev = entry->next;
+			*stack = entry->stack;
+
+			FIBER_G(stack_pool_count)--;
+
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+static zend_bool zend_fiber_stack_pool_put(zend_fiber_stack *stack)
+{
+	zend_fiber_stack_pool_entry *entry;
+
+	if (!FIBER_G(stack_pool_active) || FIBER_G(stack_pool_count) >= FIBER_G(stack_pool_size)) {
+		return 0;
+	}
+
+	entry = (zend_fiber_stack_pool_entry *) ((char *) stack->pointer + stack->size - sizeof(zend_fiber_stack_pool_entry));
+	entry->stack = *stack;
+	entry->stack.released_at = (FIBER_G(stack_reclaim_threshold) > 0) ? zend_fiber_clock() : 0;
+	entry->next = (zend_fiber_stack_pool_entry *) FIBER_G(stack_pool);
+
+	FIBER_G(stack_pool) = entry;
+	FIBER_G(stack_pool_count)++;
+
+	return 1;
+}
+
+void zend_fiber_stack_pool_init()
+{
+	FIBER_G(stack_pool_active) = 1;
+}
+
+void zend_fiber_stack_pool_reclaim(uint64_t now, uint64_t threshold)
+{
+	zend_fiber_stack_pool_entry *entry;
+
+	for (entry = FIBER_G(stack_pool); entry != NULL; entry = entry->next) {
+		if (entry->stack.released_at != 0 && entry->stack.released_at + threshold <= now) {
+			/* The pool entry lives in the top page, which is kept. */
+			zend_fiber_stack_reclaim(&entry->stack, (char *) entry->stack.pointer + entry->stack.size);
+			entry->stack.released_at = 0;
+		}
+	}
+}
+
+void zend_fiber_stack_pool_shutdown()
+{
+	zend_fiber_stack_pool_entry *entry;
+	zend_fiber_stack stack;
+
+	FIBER_G(stack_pool_active) = 0;
+
+	while (FIBER_G(stack_pool) != NULL) {
+		entry = (zend_fiber_stack_pool_entry *) FIBER_G(stack_pool);
+
+		FIBER_G(stack_pool) = entry->next;
+		stack = entry->stack;
+
+		zend_fiber_stack_release(&stack);
+	}
+
+	FIBER_G(stack_pool_count) = 0;
+}
+
+zend_bool zend_fiber_stack_allocate(zend_fiber_stack *stack, size_t size)
 {
 	static __thread size_t page_size;
 
@@ -33,21 +174,43 @@ zend_bool zend_fiber_stack_allocate(zend_fiber_stack *stack, unsigned int size)
 
 	size_t msize;
 
-	stack->size = ((size_t) size + page_size - 1) / page_size * page_size;
+	if (UNEXPECTED(size > SIZE_MAX - (ZEND_FIBER_GUARDPAGES + 1) * page_size)) {
+		return 0;
+	}
+
+	stack->size = (size + page_size - 1) / page_size * page_size;
+
+	if (zend_fiber_stack_pool_take(stack)) {
+		FIBER_G(stack_pool_hits)++;
+
+		stack->watermark = FIBER_G(stack_watermark);
+
+		if (stack->watermark) {
+			zend_fiber_stack_paint(stack);
+		}
+
+		return 1;
+	}
+
+	FIBER_G(stack_pool_misses)++;
 
 #ifdef ZEND_FIBER_MMAP
 
 	void *pointer;
+	int flags;
+
+	flags = MAP_PRIVATE | MAP_ANONYMOUS | ZEND_FIBER_MAP_STACK;
+
+	/* Only reserve address space, pages are committed when they are first touched. */
+	if (FIBER_G(stack_noreserve)) {
+		flags |= ZEND_FIBER_MAP_NORESERVE;
+	}
 
 	msize = stack->size + ZEND_FIBER_GUARDPAGES * page_size;
-	pointer = mmap(0, msize, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	pointer = mmap(0, msize, PROT_READ | PROT_WRITE, flags, -1, 0);
 
 	if (pointer == (void *) -1) {
-		pointer = mmap(0, msize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-
-		if (pointer == (void *) -1) {
-			return 0;
-		}
+		return 0;
 	}
 
 #if ZEND_FIBER_GUARDPAGES
@@ -71,10 +234,61 @@ zend_bool zend_fiber_stack_allocate(zend_fiber_stack *stack, unsigned int size)
 	stack->valgrind = VALGRIND_STACK_REGISTER(base, base + msize - ZEND_FIBER_GUARDPAGES * page_size);
 #endif
 
+	FIBER_G(stats).stack_mapped += msize;
+
+	stack->watermark = FIBER_G(stack_watermark);
+
+	if (stack->watermark) {
+		zend_fiber_stack_paint(stack);
+	}
+
 	return 1;
 }
 
+void zend_fiber_stack_reclaim(zend_fiber_stack *stack, void *sp)
+{
+#ifdef ZEND_FIBER_MADVISE
+	static __thread size_t page_size;
+
+	if (!page_size) {
+		page_size = ZEND_FIBER_PAGESIZE;
+	}
+
+	char *start;
+	char *end;
+
+	/* Releasing pages would wipe the canary pattern of painted stacks. */
+	if (stack->pointer == NULL || sp == NULL || stack->watermark) {
+		return;
+	}
+
+	/* Keep the page holding the stack pointer and the one below it untouched. */
+	start = (char *) stack->pointer;
+	end = (char *) ((uintptr_t) sp & ~((uintptr_t) page_size - 1)) - page_size;
+
+	if (end > start && end <= start + stack->size) {
+		madvise(start, end - start, ZEND_FIBER_MADVISE);
+	}
+#endif
+}
+
 void zend_fiber_stack_free(zend_fiber_stack *stack)
+{
+	if (stack->pointer != NULL) {
+		if (stack->watermark) {
+			zend_fiber_stack_record_usage(zend_fiber_stack_measure(stack));
+			stack->watermark = 0;
+		}
+
+		if (zend_fiber_stack_pool_put(stack)) {
+			stack->pointer = NULL;
+		} else {
+			zend_fiber_stack_release(stack);
+		}
+	}
+}
+
+static void zend_fiber_stack_release(zend_fiber_stack *stack)
 {
 	static __thread size_t page_size;
 
@@ -96,8 +310,12 @@ void zend_fiber_stack_free(zend_fiber_stack *stack)
 		len = stack->size + ZEND_FIBER_GUARDPAGES * page_size;
 
 		munmap(address, len);
+
+		FIBER_G(stats).stack_mapped -= len;
 #else
 		efree(stack->pointer);
+
+		FIBER_G(stats).stack_mapped -= stack->size;
 #endif
 
 		stack->pointer = NULL;
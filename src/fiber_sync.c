@@ -0,0 +1,495 @@
+/*
+  +--------------------------------------------------------------------+
+  | ext-fiber                                                          |
+  +--------------------------------------------------------------------+
+  | Redistribution and use in source and binary forms, with or without |
+  | modification, are permitted provided that the conditions mentioned |
+  | in the accompanying LICENSE file are met.                          |
+  +--------------------------------------------------------------------+
+  | Authors: Martin Schröder <m.schroeder2007@gmail.com>               |
+  |          Aaron Piotrowski <aaron@trowski.com>                      |
+  +--------------------------------------------------------------------+
+*/
+
+#include "php.h"
+#include "zend.h"
+#include "zend_API.h"
+#include "zend_exceptions.h"
+
+#include "php_fiber.h"
+#include "fiber.h"
+#include "fiber_sync.h"
+#include "fiber_scheduler.h"
+
+#ifndef ZEND_PARSE_PARAMETERS_NONE
+#define ZEND_PARSE_PARAMETERS_NONE() zend_parse_parameters_none()
+#endif
+
+static zend_class_entry *zend_ce_fiber_mutex;
+static zend_class_entry *zend_ce_fiber_semaphore;
+static zend_class_entry *zend_ce_fiber_wait_group;
+
+static zend_object_handlers zend_fiber_sync_handlers;
+
+#define ZEND_FIBER_SYNC_THIS() ((zend_fiber_sync *) Z_OBJ_P(getThis()))
+
+
+static zend_object *zend_fiber_sync_object_create(zend_class_entry *ce)
+{
+	zend_fiber_sync *sync;
+
+	sync = emalloc(sizeof(zend_fiber_sync));
+	memset(sync, 0, sizeof(zend_fiber_sync));
+
+	zend_object_std_init(&sync->std, ce);
+	sync->std.handlers = &zend_fiber_sync_handlers;
+
+	return &sync->std;
+}
+
+
+static void zend_fiber_sync_object_destroy(zend_object *object)
+{
+	zend_fiber_sync *sync;
+
+	sync = (zend_fiber_sync *) object;
+
+	/* Waiting fibers reference the object, it is only freed with them on shutdown or by the collector. */
+	while (zend_fiber_queue_shift(&sync->waiters) != NULL);
+
+	if (sync->gc_buffer != NULL) {
+		efree(sync->gc_buffer);
+	}
+
+	zend_object_std_dtor(&sync->std);
+}
+
+
+#if PHP_VERSION_ID >= 80000
+static HashTable *zend_fiber_sync_get_gc(zend_object *object, zval **table, int *n)
+#else
+static HashTable *zend_fiber_sync_get_gc(zval *object, zval **table, int *n)
+#endif
+{
+	zend_fiber_sync *sync;
+
+#if PHP_VERSION_ID >= 80000
+	sync = (zend_fiber_sync *) object;
+#else
+	sync = (zend_fiber_sync *) Z_OBJ_P(object);
+#endif
+
+	/* Parked fibers are referenced by the primitive, a cycle through their stack can be collected then. */
+	*n = (int) zend_fiber_queue_gc(&sync->waiters, &sync->gc_buffer, &sync->gc_size, 0);
+	*table = sync->gc_buffer;
+
+	return zend_std_get_properties(object);
+}
+
+
+/* Wakes up the longest waiting fiber, marking its wait as successful. */
+static zend_fiber *zend_fiber_sync_grant(zend_fiber_sync *sync)
+{
+	zend_fiber *fiber;
+
+	fiber = zend_fiber_queue_shift(&sync->waiters);
+
+	if (fiber != NULL) {
+		ZVAL_TRUE(fiber->wait_value);
+		zend_fiber_schedule(fiber, NULL);
+	}
+
+	return fiber;
+}
+
+
+/* Passes a mutex or a semaphore permit on to the next waiter, ownership is handed over without a gap. */
+static void zend_fiber_sync_release(zend_fiber_sync *sync)
+{
+	zend_fiber *fiber;
+
+	fiber = zend_fiber_sync_grant(sync);
+
+	if (sync->std.ce == zend_ce_fiber_mutex) {
+		sync->owner = fiber;
+		sync->count = (fiber != NULL) ? 1 : 0;
+	} else if (fiber == NULL) {
+		sync->count++;
+	}
+}
+
+
+/* Blocks the running fiber until it is granted the primitive, returns 0 if it has been resumed otherwise. */
+static zend_bool zend_fiber_sync_wait(zend_fiber_sync *sync)
+{
+	zend_fiber *fiber;
+	zval slot;
+
+	fiber = FIBER_G(current_fiber);
+
+	if (UNEXPECTED(fiber == NULL)) {
+		zend_throw_error(NULL, "Cannot wait for %s outside a fiber", ZSTR_VAL(sync->std.ce->name));
+		return 0;
+	}
+
+	if (fiber->status != ZEND_FIBER_STATUS_RUNNING) {
+		zend_throw_error(NULL, "Cannot wait for %s in a fiber that is not running", ZSTR_VAL(sync->std.ce->name));
+		return 0;
+	}
+
+	ZVAL_UNDEF(&slot);
+
+	fiber->wait_value = &slot;
+
+	zend_fiber_queue_push(&sync->waiters, fiber);
+	zend_fiber_park(fiber, NULL);
+
+	fiber->wait_value = NULL;
+
+	if (Z_ISUNDEF(slot)) {
+		if (!EG(exception)) {
+			zend_throw_error(NULL, "Fiber has been resumed while waiting for %s", ZSTR_VAL(sync->std.ce->name));
+		}
+
+		return 0;
+	}
+
+	/* Granted, but destroyed or failed before it could run, do not keep others waiting forever. */
+	if (EG(exception)) {
+		if (sync->std.ce != zend_ce_fiber_wait_group) {
+			zend_fiber_sync_release(sync);
+		}
+
+		return 0;
+	}
+
+	return 1;
+}
+
+
+/* {{{ proto void FiberMutex::lock() */
+ZEND_METHOD(FiberMutex, lock)
+{
+	zend_fiber_sync *sync;
+	zend_fiber *fiber;
+
+	ZEND_PARSE_PARAMETERS_NONE();
+
+	sync = ZEND_FIBER_SYNC_THIS();
+	fiber = FIBER_G(current_fiber);
+
+	if (sync->count == 0) {
+		sync->count = 1;
+		sync->owner = fiber;
+		return;
+	}
+
+	if (sync->owner == fiber) {
+		zend_throw_error(NULL, "Mutex is already locked by the current fiber");
+		return;
+	}
+
+	/* Ownership has been transferred by unlock(). */
+	zend_fiber_sync_wait(sync);
+}
+/* }}} */
+
+
+/* {{{ proto bool FiberMutex::tryLock() */
+ZEND_METHOD(FiberMutex, tryLock)
+{
+	zend_fiber_sync *sync;
+
+	ZEND_PARSE_PARAMETERS_NONE();
+
+	sync = ZEND_FIBER_SYNC_THIS();
+
+	if (sync->count != 0) {
+		RETURN_FALSE;
+	}
+
+	sync->count = 1;
+	sync->owner = FIBER_G(current_fiber);
+
+	RETURN_TRUE;
+}
+/* }}} */
+
+
+/* {{{ proto void FiberMutex::unlock() */
+ZEND_METHOD(FiberMutex, unlock)
+{
+	zend_fiber_sync *sync;
+
+	ZEND_PARSE_PARAMETERS_NONE();
+
+	sync = ZEND_FIBER_SYNC_THIS();
+
+	if (sync->count == 0) {
+		zend_throw_error(NULL, "Mutex is not locked");
+		return;
+	}
+
+	if (sync->owner != FIBER_G(current_fiber)) {
+		zend_throw_error(NULL, "Mutex can only be unlocked by the fiber that locked it");
+		return;
+	}
+
+	zend_fiber_sync_release(sync);
+}
+/* }}} */
+
+
+/* {{{ proto bool FiberMutex::isLocked() */
+ZEND_METHOD(FiberMutex, isLocked)
+{
+	ZEND_PARSE_PARAMETERS_NONE();
+
+	RETURN_BOOL(ZEND_FIBER_SYNC_THIS()->count != 0);
+}
+/* }}} */
+
+
+/* {{{ proto FiberSemaphore::__construct(int $permits) */
+ZEND_METHOD(FiberSemaphore, __construct)
+{
+	zend_long permits;
+
+	ZEND_PARSE_PARAMETERS_START_EX(ZEND_PARSE_PARAMS_THROW, 1, 1)
+		Z_PARAM_LONG(permits)
+	ZEND_PARSE_PARAMETERS_END();
+
+	if (permits < 0) {
+		zend_throw_error(NULL, "Semaphore permits must not be negative");
+		return;
+	}
+
+	ZEND_FIBER_SYNC_THIS()->count = permits;
+}
+/* }}} */
+
+
+/* {{{ proto void FiberSemaphore::acquire() */
+ZEND_METHOD(FiberSemaphore, acquire)
+{
+	zend_fiber_sync *sync;
+
+	ZEND_PARSE_PARAMETERS_NONE();
+
+	sync = ZEND_FIBER_SYNC_THIS();
+
+	/* Permits are handed to waiters directly, free permits imply an empty wait queue. */
+	if (sync->count > 0) {
+		sync->count--;
+		return;
+	}
+
+	zend_fiber_sync_wait(sync);
+}
+/* }}} */
+
+
+/* {{{ proto bool FiberSemaphore::tryAcquire() */
+ZEND_METHOD(FiberSemaphore, tryAcquire)
+{
+	zend_fiber_sync *sync;
+
+	ZEND_PARSE_PARAMETERS_NONE();
+
+	sync = ZEND_FIBER_SYNC_THIS();
+
+	if (sync->count == 0) {
+		RETURN_FALSE;
+	}
+
+	sync->count--;
+
+	RETURN_TRUE;
+}
+/* }}} */
+
+
+/* {{{ proto void FiberSemaphore::release() */
+ZEND_METHOD(FiberSemaphore, release)
+{
+	zend_fiber_sync *sync;
+
+	ZEND_PARSE_PARAMETERS_NONE();
+
+	sync = ZEND_FIBER_SYNC_THIS();
+
+	/* A permit handed to a waiter does not change the count. */
+	if (sync->waiters.head == NULL && sync->count == ZEND_LONG_MAX) {
+		zend_throw_error(NULL, "Semaphore permits must be between 0 and " ZEND_LONG_FMT, ZEND_LONG_MAX);
+		return;
+	}
+
+	zend_fiber_sync_release(sync);
+}
+/* }}} */
+
+
+/* {{{ proto int FiberSemaphore::getAvailable() */
+ZEND_METHOD(FiberSemaphore, getAvailable)
+{
+	ZEND_PARSE_PARAMETERS_NONE();
+
+	RETURN_LONG(ZEND_FIBER_SYNC_THIS()->count);
+}
+/* }}} */
+
+
+/* {{{ proto void FiberWaitGroup::add(int $delta = 1) */
+ZEND_METHOD(FiberWaitGroup, add)
+{
+	zend_fiber_sync *sync;
+	zend_long delta;
+
+	delta = 1;
+
+	ZEND_PARSE_PARAMETERS_START_EX(ZEND_PARSE_PARAMS_THROW, 0, 1)
+		Z_PARAM_OPTIONAL
+		Z_PARAM_LONG(delta)
+	ZEND_PARSE_PARAMETERS_END();
+
+	sync = ZEND_FIBER_SYNC_THIS();
+
+	if ((delta < 0) ? (sync->count < -delta) : (sync->count > ZEND_LONG_MAX - delta)) {
+		zend_throw_error(NULL, "WaitGroup counter must be between 0 and " ZEND_LONG_FMT, ZEND_LONG_MAX);
+		return;
+	}
+
+	sync->count += delta;
+
+	if (sync->count == 0) {
+		while (zend_fiber_sync_grant(sync) != NULL);
+	}
+}
+/* }}} */
+
+
+/* {{{ proto void FiberWaitGroup::done() */
+ZEND_METHOD(FiberWaitGroup, done)
+{
+	zend_fiber_sync *sync;
+
+	ZEND_PARSE_PARAMETERS_NONE();
+
+	sync = ZEND_FIBER_SYNC_THIS();
+
+	if (sync->count == 0) {
+		zend_throw_error(NULL, "WaitGroup counter must be between 0 and " ZEND_LONG_FMT, ZEND_LONG_MAX);
+		return;
+	}
+
+	sync->count--;
+
+	if (sync->count == 0) {
+		while (zend_fiber_sync_grant(sync) != NULL);
+	}
+}
+/* }}} */
+
+
+/* {{{ proto void FiberWaitGroup::wait() */
+ZEND_METHOD(FiberWaitGroup, wait)
+{
+	zend_fiber_sync *sync;
+
+	ZEND_PARSE_PARAMETERS_NONE();
+
+	sync = ZEND_FIBER_SYNC_THIS();
+
+	if (sync->count == 0) {
+		return;
+	}
+
+	zend_fiber_sync_wait(sync);
+}
+/* }}} */
+
+
+/* {{{ proto int FiberWaitGroup::count() */
+ZEND_METHOD(FiberWaitGroup, count)
+{
+	ZEND_PARSE_PARAMETERS_NONE();
+
+	RETURN_LONG(ZEND_FIBER_SYNC_THIS()->count);
+}
+/* }}} */
+
+
+ZEND_BEGIN_ARG_WITH_RETURN_TYPE_INFO_EX(arginfo_fiber_sync_void, 0, 0, IS_VOID, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_WITH_RETURN_TYPE_INFO_EX(arginfo_fiber_sync_bool, 0, 0, _IS_BOOL, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_WITH_RETURN_TYPE_INFO_EX(arginfo_fiber_sync_long, 0, 0, IS_LONG, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_semaphore_create, 0, 0, 1)
+	ZEND_ARG_TYPE_INFO(0, permits, IS_LONG, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_WITH_RETURN_TYPE_INFO_EX(arginfo_wait_group_add, 0, 0, IS_VOID, 0)
+	ZEND_ARG_TYPE_INFO(0, delta, IS_LONG, 0)
+ZEND_END_ARG_INFO()
+
+static const zend_function_entry mutex_functions[] = {
+	ZEND_ME(FiberMutex, lock, arginfo_fiber_sync_void, ZEND_ACC_PUBLIC)
+	ZEND_ME(FiberMutex, tryLock, arginfo_fiber_sync_bool, ZEND_ACC_PUBLIC)
+	ZEND_ME(FiberMutex, unlock, arginfo_fiber_sync_void, ZEND_ACC_PUBLIC)
+	ZEND_ME(FiberMutex, isLocked, arginfo_fiber_sync_bool, ZEND_ACC_PUBLIC)
+	ZEND_FE_END
+};
+
+static const zend_function_entry semaphore_functions[] = {
+	ZEND_ME(FiberSemaphore, __construct, arginfo_semaphore_create, ZEND_ACC_PUBLIC | ZEND_ACC_CTOR)
+	ZEND_ME(FiberSemaphore, acquire, arginfo_fiber_sync_void, ZEND_ACC_PUBLIC)
+	ZEND_ME(FiberSemaphore, tryAcquire, arginfo_fiber_sync_bool, ZEND_ACC_PUBLIC)
+	ZEND_ME(FiberSemaphore, release, arginfo_fiber_sync_void, ZEND_ACC_PUBLIC)
+	ZEND_ME(FiberSemaphore, getAvailable, arginfo_fiber_sync_long, ZEND_ACC_PUBLIC)
+	ZEND_FE_END
+};
+
+static const zend_function_entry wait_group_functions[] = {
+	ZEND_ME(FiberWaitGroup, add, arginfo_wait_group_add, ZEND_ACC_PUBLIC)
+	ZEND_ME(FiberWaitGroup, done, arginfo_fiber_sync_void, ZEND_ACC_PUBLIC)
+	ZEND_ME(FiberWaitGroup, wait, arginfo_fiber_sync_void, ZEND_ACC_PUBLIC)
+	ZEND_ME(FiberWaitGroup, count, arginfo_fiber_sync_long, ZEND_ACC_PUBLIC)
+	ZEND_FE_END
+};
+
+
+static zend_class_entry *zend_fiber_sync_register_class(const char *name, size_t name_len, const zend_function_entry *functions)
+{
+	zend_class_entry ce;
+	zend_class_entry *entry;
+
+	INIT_CLASS_ENTRY_EX(ce, name, name_len, functions);
+	entry = zend_register_internal_class(&ce);
+	entry->ce_flags |= ZEND_ACC_FINAL;
+	entry->create_object = zend_fiber_sync_object_create;
+	entry->serialize = zend_class_serialize_deny;
+	entry->unserialize = zend_class_unserialize_deny;
+
+	return entry;
+}
+
+void zend_fiber_sync_ce_register()
+{
+	zend_ce_fiber_mutex = zend_fiber_sync_register_class("FiberMutex", sizeof("FiberMutex") - 1, mutex_functions);
+	zend_ce_fiber_semaphore = zend_fiber_sync_register_class("FiberSemaphore", sizeof("FiberSemaphore") - 1, semaphore_functions);
+	zend_ce_fiber_wait_group = zend_fiber_sync_register_class("FiberWaitGroup", sizeof("FiberWaitGroup") - 1, wait_group_functions);
+
+	memcpy(&zend_fiber_sync_handlers, &std_object_handlers, sizeof(zend_object_handlers));
+	zend_fiber_sync_handlers.free_obj = zend_fiber_sync_object_destroy;
+	zend_fiber_sync_handlers.get_gc = zend_fiber_sync_get_gc;
+	zend_fiber_sync_handlers.clone_obj = NULL;
+}
+
+/*
+ * vim: sw=4 ts=4
+ * vim600: fdm=marker
+ */
@@ -0,0 +1,963 @@
+/*
+  +--------------------------------------------------------------------+
+  | ext-fiber                                                          |
+  +--------------------------------------------------------------------+
+  | Redistribution and use in source and binary forms, with or without |
+  | modification, are permitted provided that the conditions mentioned |
+  | in the accompanying LICENSE file are met.                          |
+  +--------------------------------------------------------------------+
+  | Authors: Martin Schröder <m.schroeder2007@gmail.com>               |
+  |          Aaron Piotrowski <aaron@trowski.com>                      |
+  +--------------------------------------------------------------------+
+*/
+
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "php.h"
+#include "php_network.h"
+#include "zend.h"
+#include "zend_API.h"
+#include "zend_exceptions.h"
+
+#include "php_fiber.h"
+#include "fiber.h"
+#include "fiber_scheduler.h"
+#include "fiber_reactor.h"
+#include "fiber_thread.h"
+
+#include <fcntl.h>
+
+#ifndef PHP_WIN32
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#endif
+
+#if defined(HAVE_FIBER_THREAD_POOL) && !defined(PHP_WIN32)
+#define ZEND_FIBER_THREAD_POOL 1
+#include <pthread.h>
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
+#ifdef HAVE_SYS_EVENTFD_H
+#include <sys/eventfd.h>
+#endif
+#endif
+
+static zend_class_entry *zend_ce_fiber_thread_pool;
+
+
+static void zend_fiber_task_resolve(zend_fiber_task *task)
+{
+	struct addrinfo hints;
+	struct addrinfo *info;
+	struct addrinfo *entry;
+	char address[INET6_ADDRSTRLEN];
+	const void *addr;
+	char *result;
+	size_t length;
+
+	memset(&hints, 0, sizeof(struct addrinfo));
+
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+
+	task->error = getaddrinfo(task->arg, NULL, &hints, &info);
+
+	if (task->error != 0) {
+		return;
+	}
+
+	/* Addresses are packed into one buffer, each one terminated by a NUL byte. */
+	for (entry = info; entry != NULL; entry = entry->ai_next) {
+		if (entry->ai_family == AF_INET) {
+			addr = &((struct sockaddr_in *) entry->ai_addr)->sin_addr;
+		} else if (entry->ai_family == AF_INET6) {
+			addr = &((struct sockaddr_in6 *) entry->ai_addr)->sin6_addr;
+		} else {
+			continue;
+		}
+
+		if (inet_ntop(entry->ai_family, addr, address, sizeof(address)) == NULL) {
+			continue;
+		}
+
+		length = strlen(address) + 1;
+		result = realloc(task->result, task->length + length);
+
+		if (result == NULL) {
+			break;
+		}
+
+		memcpy(result + task->length, address, length);
+
+		task->result = result;
+		task->length += length;
+	}
+
+	freeaddrinfo(info);
+}
+
+
+static void zend_fiber_task_stat(zend_fiber_task *task)
+{
+	task->error = (php_sys_stat(task->arg, &task->st) == 0) ? 0 : errno;
+}
+
+
+static void zend_fiber_task_read_file(zend_fiber_task *task)
+{
+	char *buffer;
+	size_t capacity;
+	ssize_t count;
+	int flags;
+	int fd;
+
+	flags = O_RDONLY;
+
+#ifdef O_CLOEXEC
+	flags |= O_CLOEXEC;
+#endif
+
+	fd = open(task->arg, flags);
+
+	if (fd < 0) {
+		task->error = errno;
+		return;
+	}
+
+	/* Regular files are read in one go, the size is only a hint as the file may change meanwhile. */
+	capacity = 8192;
+
+	if (php_sys_stat(task->arg, &task->st) == 0 && task->st.st_size > 0) {
+		capacity = (size_t) task->st.st_size + 1;
+	}
+
+	while (1) {
+		if (task->result == NULL || task->length == capacity) {
+			if (task->result != NULL) {
+				capacity *= 2;
+			}
+
+			buffer = realloc(task->result, capacity);
+
+			if (buffer == NULL) {
+				task->error = ENOMEM;
+				break;
+			}
+
+			task->result = buffer;
+		}
+
+		count = read(fd, task->result + task->length, (unsigned int) (capacity - task->length));
+
+		if (count < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			task->error = errno;
+			break;
+		}
+
+		if (count == 0) {
+			break;
+		}
+
+		task->length += (size_t) count;
+	}
+
+	close(fd);
+}
+
+
+void zend_fiber_task_free(zend_fiber_task *task)
+{
+	free(task->arg);
+	free(task->result);
+	free(task);
+}
+
+
+#ifdef ZEND_FIBER_THREAD_POOL
+
+/* Workers are shared by all requests (threads in ZTS builds) of the process and started on first use. */
+static struct {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+
+	/* Submitted tasks that have not been picked up by a worker yet. */
+	zend_fiber_task *head;
+	zend_fiber_task *tail;
+
+	pthread_t *threads;
+	int count;
+
+	/* Workers that have not exited yet, signalled through exited on shutdown. */
+	int running;
+	pthread_cond_t exited;
+
+	zend_bool stopping;
+	zend_bool atfork;
+} zend_fiber_thread_pool = {
+	PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, NULL, NULL, NULL, 0, 0, PTHREAD_COND_INITIALIZER, 0, 0
+};
+
+
+static void zend_fiber_tasks_free(zend_fiber_tasks *tasks)
+{
+	zend_fiber_task *task;
+	zend_fiber_task *next;
+
+	/* Tasks published after the request has ended are left on the stack. */
+	for (task = tasks->completed; task != NULL; task = next) {
+		next = task->next;
+
+		zend_fiber_task_free(task);
+	}
+
+	if (tasks->notify_write != tasks->notify_read) {
+		close(tasks->notify_write);
+	}
+
+	close(tasks->notify_read);
+
+	free(tasks);
+}
+
+
+static void zend_fiber_tasks_release(zend_fiber_tasks *tasks)
+{
+	if (__atomic_sub_fetch(&tasks->refcount, 1, __ATOMIC_ACQ_REL) == 0) {
+		zend_fiber_tasks_free(tasks);
+	}
+}
+
+
+/* Publishes the task to its owner, the owner is only notified if its completion stack has been empty. It drains the
+ * notification before taking the stack, a notification can therefore never get lost. */
+static void zend_fiber_task_publish(zend_fiber_task *task)
+{
+	zend_fiber_tasks *tasks;
+	zend_fiber_task *head;
+	uint64_t one;
+	ssize_t result;
+
+	tasks = task->owner;
+	head = __atomic_load_n(&tasks->completed, __ATOMIC_RELAXED);
+
+	do {
+		task->next = head;
+	} while (!__atomic_compare_exchange_n(&tasks->completed, &head, task, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+	/* The task may be freed by its owner from here on. */
+	if (head == NULL) {
+		one = 1;
+
+		do {
+			result = write(tasks->notify_write, &one, sizeof(one));
+		} while (result < 0 && errno == EINTR);
+	}
+}
+
+
+static void *zend_fiber_thread_main(void *arg)
+{
+	zend_fiber_tasks *tasks;
+	zend_fiber_task *task;
+
+	pthread_mutex_lock(&zend_fiber_thread_pool.lock);
+
+	while (1) {
+		while (zend_fiber_thread_pool.head == NULL && !zend_fiber_thread_pool.stopping) {
+			pthread_cond_wait(&zend_fiber_thread_pool.cond, &zend_fiber_thread_pool.lock);
+		}
+
+		task = zend_fiber_thread_pool.head;
+
+		if (task == NULL) {
+			break;
+		}
+
+		zend_fiber_thread_pool.head = task->next;
+
+		if (zend_fiber_thread_pool.head == NULL) {
+			zend_fiber_thread_pool.tail = NULL;
+		}
+
+		pthread_mutex_unlock(&zend_fiber_thread_pool.lock);
+
+		tasks = task->owner;
+
+		/* Nobody is waiting for the tasks of a request that has ended. */
+		if (!__atomic_load_n(&tasks->abandoned, __ATOMIC_ACQUIRE)) {
+			task->func(task);
+		}
+
+		zend_fiber_task_publish(task);
+		zend_fiber_tasks_release(tasks);
+
+		pthread_mutex_lock(&zend_fiber_thread_pool.lock);
+	}
+
+	zend_fiber_thread_pool.running--;
+
+	pthread_cond_signal(&zend_fiber_thread_pool.exited);
+	pthread_mutex_unlock(&zend_fiber_thread_pool.lock);
+
+	return NULL;
+}
+
+
+/* Takes the completion stack of the queue, the returned list is in completion order. */
+static zend_fiber_task *zend_fiber_tasks_take(zend_fiber_tasks *tasks)
+{
+	zend_fiber_task *task;
+	zend_fiber_task *next;
+	zend_fiber_task *list;
+
+	task = __atomic_exchange_n(&tasks->completed, NULL, __ATOMIC_ACQUIRE);
+	list = NULL;
+
+	for (; task != NULL; task = next) {
+		next = task->next;
+		task->next = list;
+		list = task;
+	}
+
+	return list;
+}
+
+
+static void zend_fiber_tasks_complete(zend_fiber_tasks *tasks, zend_fiber_task *task)
+{
+	if (task->inflight_prev != NULL) {
+		task->inflight_prev->inflight_next = task->inflight_next;
+	} else {
+		tasks->inflight = task->inflight_next;
+	}
+
+	if (task->inflight_next != NULL) {
+		task->inflight_next->inflight_prev = task->inflight_prev;
+	}
+
+	if (task->fiber == NULL) {
+		zend_fiber_task_free(task);
+		return;
+	}
+
+	ZVAL_TRUE(task->fiber->wait_value);
+
+	zend_fiber_schedule(task->fiber, NULL);
+}
+
+
+static int zend_fiber_tasks_collect(zend_fiber_tasks *tasks)
+{
+	zend_fiber_task *task;
+	zend_fiber_task *next;
+	char buffer[64];
+	int count;
+
+	/* Drained before the stack is taken, a worker publishing in between notifies again. */
+	while (read(tasks->notify_read, buffer, sizeof(buffer)) > 0);
+
+	count = 0;
+
+	for (task = zend_fiber_tasks_take(tasks); task != NULL; task = next) {
+		next = task->next;
+
+		zend_fiber_tasks_complete(tasks, task);
+		count++;
+	}
+
+	return count;
+}
+
+
+/* Only the forking thread survives in the child, workers and the tasks they were running are gone. The pool is
+ * started again on demand. Tasks in flight are cancelled and the queue of the request is dropped, its notification
+ * fd is shared with the parent. The reactor gets an epoll instance of its own before the fd is unwatched, the
+ * inherited instance is shared with the parent as well. */
+static void zend_fiber_thread_pool_atfork_child()
+{
+	zend_fiber_tasks *tasks;
+	zend_fiber_task *task;
+	zend_fiber_task *next;
+
+	pthread_mutex_init(&zend_fiber_thread_pool.lock, NULL);
+	pthread_cond_init(&zend_fiber_thread_pool.cond, NULL);
+	pthread_cond_init(&zend_fiber_thread_pool.exited, NULL);
+
+	if (zend_fiber_thread_pool.threads != NULL) {
+		pefree(zend_fiber_thread_pool.threads, 1);
+	}
+
+	zend_fiber_thread_pool.head = NULL;
+	zend_fiber_thread_pool.tail = NULL;
+	zend_fiber_thread_pool.threads = NULL;
+	zend_fiber_thread_pool.count = 0;
+	zend_fiber_thread_pool.running = 0;
+
+#ifdef ZTS
+	/* Threads that never ran a request have no completion queue. */
+	if (tsrm_get_ls_cache() == NULL) {
+		return;
+	}
+#endif
+
+	tasks = FIBER_G(tasks);
+
+	if (tasks == NULL) {
+		return;
+	}
+
+	FIBER_G(tasks) = NULL;
+
+	for (task = zend_fiber_tasks_take(tasks); task != NULL; task = next) {
+		next = task->next;
+
+		zend_fiber_tasks_complete(tasks, task);
+	}
+
+	while (tasks->inflight != NULL) {
+		task = tasks->inflight;
+		task->cancelled = 1;
+
+		zend_fiber_tasks_complete(tasks, task);
+	}
+
+	zend_fiber_reactor_fork();
+	zend_fiber_reactor_unwatch_completions(tasks->notify_read);
+
+	/* The tasks have been taken over by the request, nothing in the child references the queue anymore. */
+	zend_fiber_tasks_free(tasks);
+}
+
+
+/* Starts the workers, must be called with the pool locked. */
+static zend_bool zend_fiber_thread_pool_start()
+{
+	sigset_t mask;
+	sigset_t previous;
+	int count;
+	int i;
+
+	if (zend_fiber_thread_pool.count > 0) {
+		return 1;
+	}
+
+	if (zend_fiber_thread_pool.stopping) {
+		return 0;
+	}
+
+	if (!zend_fiber_thread_pool.atfork) {
+		if (pthread_atfork(NULL, NULL, zend_fiber_thread_pool_atfork_child) != 0) {
+			return 0;
+		}
+
+		zend_fiber_thread_pool.atfork = 1;
+	}
+
+	count = (int) FIBER_G(thread_pool_size);
+
+	zend_fiber_thread_pool.threads = pemalloc(sizeof(pthread_t) * count, 1);
+
+	/* Signals (timeouts, pcntl) must be handled by the request threads, workers inherit a blocked mask. */
+	sigfillset(&mask);
+	pthread_sigmask(SIG_SETMASK, &mask, &previous);
+
+	for (i = 0; i < count; i++) {
+		if (pthread_create(&zend_fiber_thread_pool.threads[i], NULL, zend_fiber_thread_main, NULL) != 0) {
+			break;
+		}
+	}
+
+	pthread_sigmask(SIG_SETMASK, &previous, NULL);
+
+	zend_fiber_thread_pool.count = i;
+	zend_fiber_thread_pool.running = i;
+
+	if (i == 0) {
+		pefree(zend_fiber_thread_pool.threads, 1);
+		zend_fiber_thread_pool.threads = NULL;
+
+		return 0;
+	}
+
+	return 1;
+}
+
+
+/* Creates the completion queue of the request and registers its notification fd with the reactor. */
+static zend_fiber_tasks *zend_fiber_tasks_create()
+{
+	zend_fiber_tasks *tasks;
+#ifndef HAVE_SYS_EVENTFD_H
+	int fds[2];
+#endif
+
+	if (FIBER_G(tasks) != NULL) {
+		return FIBER_G(tasks);
+	}
+
+	tasks = malloc(sizeof(zend_fiber_tasks));
+
+	if (tasks == NULL) {
+		return NULL;
+	}
+
+	memset(tasks, 0, sizeof(zend_fiber_tasks));
+
+	tasks->refcount = 1;
+
+#ifdef HAVE_SYS_EVENTFD_H
+	tasks->notify_read = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+	if (tasks->notify_read < 0) {
+		free(tasks);
+		return NULL;
+	}
+
+	tasks->notify_write = tasks->notify_read;
+#else
+	if (pipe(fds) != 0) {
+		free(tasks);
+		return NULL;
+	}
+
+	fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+	fcntl(fds[1], F_SETFL, fcntl(fds[1], F_GETFL) | O_NONBLOCK);
+	fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+	fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+
+	tasks->notify_read = fds[0];
+	tasks->notify_write = fds[1];
+#endif
+
+	if (!zend_fiber_reactor_watch_completions(tasks->notify_read, zend_fiber_tasks_reap)) {
+		zend_fiber_tasks_free(tasks);
+		return NULL;
+	}
+
+	FIBER_G(tasks) = tasks;
+
+	return tasks;
+}
+
+#endif
+
+
+zend_bool zend_fiber_task_run(zend_fiber *fiber, zend_fiber_task *task)
+{
+#ifdef ZEND_FIBER_THREAD_POOL
+	zend_fiber_tasks *tasks;
+	zval slot;
+
+	if (FIBER_G(thread_pool_size) > 0 && (tasks = zend_fiber_tasks_create()) != NULL) {
+		pthread_mutex_lock(&zend_fiber_thread_pool.lock);
+
+		if (zend_fiber_thread_pool_start()) {
+			task->fiber = fiber;
+			task->owner = tasks;
+			task->next = NULL;
+
+			if (zend_fiber_thread_pool.tail != NULL) {
+				zend_fiber_thread_pool.tail->next = task;
+			} else {
+				zend_fiber_thread_pool.head = task;
+			}
+
+			zend_fiber_thread_pool.tail = task;
+
+			__atomic_add_fetch(&tasks->refcount, 1, __ATOMIC_RELAXED);
+
+			pthread_cond_signal(&zend_fiber_thread_pool.cond);
+			pthread_mutex_unlock(&zend_fiber_thread_pool.lock);
+
+			task->inflight_prev = NULL;
+			task->inflight_next = tasks->inflight;
+
+			if (tasks->inflight != NULL) {
+				tasks->inflight->inflight_prev = task;
+			}
+
+			tasks->inflight = task;
+
+			/* Set to true once the task has been reaped, to false if the request has ended meanwhile. */
+			ZVAL_UNDEF(&slot);
+
+			fiber->wait_value = &slot;
+
+			zend_fiber_park(fiber, NULL);
+
+			fiber->wait_value = NULL;
+
+			if (Z_TYPE(slot) == IS_TRUE) {
+				return 1;
+			}
+
+			/* Resumed before the task completed, it is released once the worker is done with it. An abandoned
+			 * task belongs to the queue and must not be touched anymore. */
+			if (Z_ISUNDEF(slot)) {
+				task->fiber = NULL;
+			}
+
+			return 0;
+		}
+
+		pthread_mutex_unlock(&zend_fiber_thread_pool.lock);
+	}
+#endif
+
+	/* No workers available, the calling thread blocks instead. */
+	task->func(task);
+
+	return 1;
+}
+
+
+int zend_fiber_tasks_reap()
+{
+#ifdef ZEND_FIBER_THREAD_POOL
+	if (FIBER_G(tasks) == NULL) {
+		return 0;
+	}
+
+	return zend_fiber_tasks_collect(FIBER_G(tasks));
+#else
+	return 0;
+#endif
+}
+
+
+zend_bool zend_fiber_tasks_pending()
+{
+	return FIBER_G(tasks) != NULL && FIBER_G(tasks)->inflight != NULL;
+}
+
+
+static zend_fiber_task *zend_fiber_task_submit(zend_fiber_task_func func, const char *arg, size_t length)
+{
+	zend_fiber *fiber;
+	zend_fiber_task *task;
+
+	fiber = FIBER_G(current_fiber);
+
+	if (UNEXPECTED(fiber == NULL)) {
+		zend_throw_error(NULL, "Cannot offload blocking work from outside a fiber");
+		return NULL;
+	}
+
+	if (UNEXPECTED(strlen(arg) != length)) {
+		zend_throw_error(NULL, "Argument must not contain any null bytes");
+		return NULL;
+	}
+
+	/* Allocated with malloc(), an abandoned task may outlive the request. */
+	task = calloc(1, sizeof(zend_fiber_task));
+
+	if (UNEXPECTED(task == NULL)) {
+		zend_throw_error(NULL, "Failed to allocate memory for the task");
+		return NULL;
+	}
+
+	task->func = func;
+	task->arg = malloc(length + 1);
+
+	if (UNEXPECTED(task->arg == NULL)) {
+		free(task);
+
+		zend_throw_error(NULL, "Failed to allocate memory for the task");
+		return NULL;
+	}
+
+	memcpy(task->arg, arg, length + 1);
+
+	if (!zend_fiber_task_run(fiber, task)) {
+		if (!EG(exception)) {
+			zend_throw_error(NULL, "Fiber has been resumed before the task completed");
+		}
+
+		return NULL;
+	}
+
+	/* The fiber is being destroyed. */
+	if (UNEXPECTED(EG(exception))) {
+		zend_fiber_task_free(task);
+
+		return NULL;
+	}
+
+	if (UNEXPECTED(task->cancelled)) {
+		zend_throw_error(NULL, "Task has been cancelled as the process forked");
+		zend_fiber_task_free(task);
+
+		return NULL;
+	}
+
+	return task;
+}
+
+
+/* Resolves the path against the (virtual) working directory of the request and applies open_basedir, workers are
+ * handed the resulting absolute path. */
+static zend_bool zend_fiber_task_check_path(zend_string *path, char *resolved)
+{
+	if (expand_filepath(ZSTR_VAL(path), resolved) == NULL) {
+		zend_throw_error(NULL, "Failed to resolve path %s", ZSTR_VAL(path));
+		return 0;
+	}
+
+	if (php_check_open_basedir_ex(resolved, 0) != 0) {
+		zend_throw_error(NULL, "open_basedir restriction in effect, %s is not within the allowed path(s)", ZSTR_VAL(path));
+		return 0;
+	}
+
+	return 1;
+}
+
+
+/* {{{ proto array FiberThreadPool::resolve(string $hostname) */
+ZEND_METHOD(FiberThreadPool, resolve)
+{
+	zend_fiber_task *task;
+	zend_string *hostname;
+	char *address;
+
+	ZEND_PARSE_PARAMETERS_START_EX(ZEND_PARSE_PARAMS_THROW, 1, 1)
+		Z_PARAM_STR(hostname)
+	ZEND_PARSE_PARAMETERS_END();
+
+	task = zend_fiber_task_submit(zend_fiber_task_resolve, ZSTR_VAL(hostname), ZSTR_LEN(hostname));
+
+	if (task == NULL) {
+		return;
+	}
+
+	if (task->error != 0) {
+		zend_throw_error(NULL, "Failed to resolve %s: %s", ZSTR_VAL(hostname), gai_strerror(task->error));
+		zend_fiber_task_free(task);
+
+		return;
+	}
+
+	array_init(return_value);
+
+	for (address = task->result; address < task->result + task->length; address += strlen(address) + 1) {
+		add_next_index_string(return_value, address);
+	}
+
+	zend_fiber_task_free(task);
+}
+/* }}} */
+
+
+/* {{{ proto array FiberThreadPool::stat(string $path) */
+ZEND_METHOD(FiberThreadPool, stat)
+{
+	zend_fiber_task *task;
+	zend_string *path;
+	char resolved[MAXPATHLEN];
+
+	ZEND_PARSE_PARAMETERS_START_EX(ZEND_PARSE_PARAMS_THROW, 1, 1)
+		Z_PARAM_PATH_STR(path)
+	ZEND_PARSE_PARAMETERS_END();
+
+	if (!zend_fiber_task_check_path(path, resolved)) {
+		return;
+	}
+
+	task = zend_fiber_task_submit(zend_fiber_task_stat, resolved, strlen(resolved));
+
+	if (task == NULL) {
+		return;
+	}
+
+	if (task->error != 0) {
+		zend_throw_error(NULL, "Failed to stat %s: %s", ZSTR_VAL(path), strerror(task->error));
+		zend_fiber_task_free(task);
+
+		return;
+	}
+
+	array_init(return_value);
+
+	add_assoc_long(return_value, "dev", (zend_long) task->st.st_dev);
+	add_assoc_long(return_value, "ino", (zend_long) task->st.st_ino);
+	add_assoc_long(return_value, "mode", (zend_long) task->st.st_mode);
+	add_assoc_long(return_value, "nlink", (zend_long) task->st.st_nlink);
+	add_assoc_long(return_value, "uid", (zend_long) task->st.st_uid);
+	add_assoc_long(return_value, "gid", (zend_long) task->st.st_gid);
+	add_assoc_long(return_value, "rdev", (zend_long) task->st.st_rdev);
+	add_assoc_long(return_value, "size", (zend_long) task->st.st_size);
+	add_assoc_long(return_value, "atime", (zend_long) task->st.st_atime);
+	add_assoc_long(return_value, "mtime", (zend_long) task->st.st_mtime);
+	add_assoc_long(return_value, "ctime", (zend_long) task->st.st_ctime);
+
+	zend_fiber_task_free(task);
+}
+/* }}} */
+
+
+/* {{{ proto string FiberThreadPool::readFile(string $path) */
+ZEND_METHOD(FiberThreadPool, readFile)
+{
+	zend_fiber_task *task;
+	zend_string *path;
+	char resolved[MAXPATHLEN];
+
+	ZEND_PARSE_PARAMETERS_START_EX(ZEND_PARSE_PARAMS_THROW, 1, 1)
+		Z_PARAM_PATH_STR(path)
+	ZEND_PARSE_PARAMETERS_END();
+
+	if (!zend_fiber_task_check_path(path, resolved)) {
+		return;
+	}
+
+	task = zend_fiber_task_submit(zend_fiber_task_read_file, resolved, strlen(resolved));
+
+	if (task == NULL) {
+		return;
+	}
+
+	if (task->error != 0) {
+		zend_throw_error(NULL, "Failed to read %s: %s", ZSTR_VAL(path), strerror(task->error));
+		zend_fiber_task_free(task);
+
+		return;
+	}
+
+	if (task->length == 0) {
+		RETVAL_EMPTY_STRING();
+	} else {
+		RETVAL_STRINGL(task->result, task->length);
+	}
+
+	zend_fiber_task_free(task);
+}
+/* }}} */
+
+
+ZEND_BEGIN_ARG_WITH_RETURN_TYPE_INFO_EX(arginfo_fiber_thread_pool_resolve, 0, 1, IS_ARRAY, 0)
+	ZEND_ARG_TYPE_INFO(0, hostname, IS_STRING, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_WITH_RETURN_TYPE_INFO_EX(arginfo_fiber_thread_pool_stat, 0, 1, IS_ARRAY, 0)
+	ZEND_ARG_TYPE_INFO(0, path, IS_STRING, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_WITH_RETURN_TYPE_INFO_EX(arginfo_fiber_thread_pool_read_file, 0, 1, IS_STRING, 0)
+	ZEND_ARG_TYPE_INFO(0, path, IS_STRING, 0)
+ZEND_END_ARG_INFO()
+
+static const zend_function_entry fiber_thread_pool_functions[] = {
+	ZEND_ME(FiberThreadPool, resolve, arginfo_fiber_thread_pool_resolve, ZEND_ACC_PUBLIC | ZEND_ACC_STATIC)
+	ZEND_ME(FiberThreadPool, stat, arginfo_fiber_thread_pool_stat, ZEND_ACC_PUBLIC | ZEND_ACC_STATIC)
+	ZEND_ME(FiberThreadPool, readFile, arginfo_fiber_thread_pool_read_file, ZEND_ACC_PUBLIC | ZEND_ACC_STATIC)
+	ZEND_FE_END
+};
+
+
+void zend_fiber_thread_ce_register()
+{
+	zend_class_entry ce;
+
+	INIT_CLASS_ENTRY(ce, "FiberThreadPool", fiber_thread_pool_functions);
+	zend_ce_fiber_thread_pool = zend_register_internal_class(&ce);
+	zend_ce_fiber_thread_pool->ce_flags |= ZEND_ACC_FINAL;
+	zend_ce_fiber_thread_pool->create_object = NULL;
+	zend_ce_fiber_thread_pool->serialize = zend_class_serialize_deny;
+	zend_ce_fiber_thread_pool->unserialize = zend_class_unserialize_deny;
+}
+
+void zend_fiber_tasks_startup()
+{
+	FIBER_G(tasks) = NULL;
+}
+
+void zend_fiber_tasks_shutdown()
+{
+#ifdef ZEND_FIBER_THREAD_POOL
+	zend_fiber_tasks *tasks;
+	zend_fiber_task *task;
+
+	tasks = FIBER_G(tasks);
+
+	if (tasks == NULL) {
+		return;
+	}
+
+	FIBER_G(tasks) = NULL;
+
+	/* Tasks in flight are abandoned rather than waited for, a worker may be blocked indefinitely. Their fibers
+	 * are destroyed afterwards and must not touch them anymore. */
+	for (task = tasks->inflight; task != NULL; task = task->inflight_next) {
+		if (task->fiber != NULL) {
+			ZVAL_FALSE(task->fiber->wait_value);
+		}
+	}
+
+	__atomic_store_n(&tasks->abandoned, 1, __ATOMIC_RELEASE);
+
+	zend_fiber_tasks_release(tasks);
+#endif
+}
+
+zend_bool zend_fiber_thread_pool_shutdown()
+{
+#ifdef ZEND_FIBER_THREAD_POOL
+	struct timespec deadline;
+	zend_bool joined;
+	int i;
+
+	pthread_mutex_lock(&zend_fiber_thread_pool.lock);
+
+	zend_fiber_thread_pool.stopping = 1;
+
+	pthread_cond_broadcast(&zend_fiber_thread_pool.cond);
+
+	/* A worker blocked in a task (getaddrinfo(), a hung NFS mount) must not hang the shutdown of the process. */
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += ZEND_FIBER_THREAD_POOL_JOIN_TIMEOUT;
+
+	while (zend_fiber_thread_pool.running > 0) {
+		if (pthread_cond_timedwait(&zend_fiber_thread_pool.exited, &zend_fiber_thread_pool.lock, &deadline) == ETIMEDOUT) {
+			break;
+		}
+	}
+
+	joined = (zend_fiber_thread_pool.running == 0);
+
+	pthread_mutex_unlock(&zend_fiber_thread_pool.lock);
+
+	/* Workers that have exited are joined, the others are left to finish their task on their own. */
+	for (i = 0; i < zend_fiber_thread_pool.count; i++) {
+		if (joined) {
+			pthread_join(zend_fiber_thread_pool.threads[i], NULL);
+		} else {
+			pthread_detach(zend_fiber_thread_pool.threads[i]);
+		}
+	}
+
+	if (zend_fiber_thread_pool.threads != NULL) {
+		pefree(zend_fiber_thread_pool.threads, 1);
+	}
+
+	zend_fiber_thread_pool.threads = NULL;
+	zend_fiber_thread_pool.count = 0;
+
+	return joined;
+#else
+	return 1;
+#endif
+}
+
+/*
+ * vim: sw=4 ts=4
+ * vim600: fdm=marker
+ */
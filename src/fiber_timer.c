@@ -0,0 +1,375 @@
+/*
+  +--------------------------------------------------------------------+
+  | ext-fiber                                                          |
+  +--------------------------------------------------------------------+
+  | Redistribution and use in source and binary forms, with or without |
+  | modification, are permitted provided that the conditions mentioned |
+  | in the accompanying LICENSE file are met.                          |
+  +--------------------------------------------------------------------+
+  | Authors: Martin Schröder <m.schroeder2007@gmail.com>               |
+  |          Aaron Piotrowski <aaron@trowski.com>                      |
+  +--------------------------------------------------------------------+
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "php.h"
+#include "zend.h"
+
+#include "php_fiber.h"
+#include "fiber.h"
+#include "fiber_timer.h"
+
+#define ZEND_FIBER_TIMER_MASK (ZEND_FIBER_TIMER_SLOTS - 1)
+
+/* Ticks covered by the wheel, timers further out are parked in the last level and placed again later on. */
+#define ZEND_FIBER_TIMER_SPAN (((uint64_t) 1) << (ZEND_FIBER_TIMER_SLOT_BITS * ZEND_FIBER_TIMER_LEVELS))
+
+
+static zend_always_inline int zend_fiber_timer_ntz(uint64_t bits)
+{
+#if PHP_HAVE_BUILTIN_CTZLL
+	return __builtin_ctzll(bits);
+#else
+	int n;
+
+	for (n = 0; !(bits & 1); n++) {
+		bits >>= 1;
+	}
+
+	return n;
+#endif
+}
+
+
+static void zend_fiber_timer_link(zend_fiber_timer_wheel *wheel, zend_fiber_timer *timer, int level, int index)
+{
+	zend_fiber_timer **slot;
+
+	slot = &wheel->slots[level][index];
+
+	timer->prev = NULL;
+	timer->next = *slot;
+
+	if (*slot != NULL) {
+		(*slot)->prev = timer;
+	}
+
+	*slot = timer;
+	timer->slot = slot;
+
+	wheel->occupied[level] |= ((uint64_t) 1) << index;
+}
+
+
+static void zend_fiber_timer_unlink(zend_fiber_timer_wheel *wheel, zend_fiber_timer *timer)
+{
+	ptrdiff_t index;
+
+	if (timer->prev != NULL) {
+		timer->prev->next = timer->next;
+	} else {
+		*timer->slot = timer->next;
+	}
+
+	if (timer->next != NULL) {
+		timer->next->prev = timer->prev;
+	}
+
+	if (*timer->slot == NULL) {
+		index = timer->slot - &wheel->slots[0][0];
+
+		wheel->occupied[index / ZEND_FIBER_TIMER_SLOTS] &= ~(((uint64_t) 1) << (index % ZEND_FIBER_TIMER_SLOTS));
+	}
+
+	timer->slot = NULL;
+	timer->prev = NULL;
+	timer->next = NULL;
+}
+
+
+/* Level l holds timers due in [64^l, 64^(l + 1)) ticks, they move down a level whenever their slot comes up. */
+static void zend_fiber_timer_place(zend_fiber_timer_wheel *wheel, zend_fiber_timer *timer)
+{
+	uint64_t expires;
+	uint64_t delta;
+	int level;
+
+	expires = MAX(timer->expires, wheel->now);
+	delta = expires - wheel->now;
+
+	if (delta >= ZEND_FIBER_TIMER_SPAN) {
+		expires = wheel->now + ZEND_FIBER_TIMER_SPAN - 1;
+		delta = ZEND_FIBER_TIMER_SPAN - 1;
+	}
+
+	for (level = 0; level < ZEND_FIBER_TIMER_LEVELS - 1; level++) {
+		if (delta < (((uint64_t) 1) << (ZEND_FIBER_TIMER_SLOT_BITS * (level + 1)))) {
+			break;
+		}
+	}
+
+	zend_fiber_timer_link(wheel, timer, level, (int) ((expires >> (ZEND_FIBER_TIMER_SLOT_BITS * level)) & ZEND_FIBER_TIMER_MASK));
+}
+
+
+/* Computes the earliest tick at which a slot has to be processed, either to expire or to cascade timers. */
+static uint64_t zend_fiber_timer_next(zend_fiber_timer_wheel *wheel)
+{
+	uint64_t next;
+	uint64_t bits;
+	uint64_t current;
+	uint64_t candidate;
+	int shift;
+	int level;
+	int start;
+
+	next = UINT64_MAX;
+
+	for (level = 0; level < ZEND_FIBER_TIMER_LEVELS; level++) {
+		bits = wheel->occupied[level];
+
+		if (bits == 0) {
+			continue;
+		}
+
+		shift = ZEND_FIBER_TIMER_SLOT_BITS * level;
+		current = wheel->now >> shift;
+
+		/* Slots are searched starting after the current one, the current slot counts as 64 slots ahead. */
+		start = (int) ((current + 1) & ZEND_FIBER_TIMER_MASK);
+
+		if (start != 0) {
+			bits = (bits >> start) | (bits << (ZEND_FIBER_TIMER_SLOTS - start));
+		}
+
+		candidate = (current + zend_fiber_timer_ntz(bits) + 1) << shift;
+
+		if (candidate < next) {
+			next = candidate;
+		}
+	}
+
+	return next;
+}
+
+
+static int zend_fiber_timer_process(zend_fiber_timer_wheel *wheel)
+{
+	zend_fiber_timer *timer;
+	zend_fiber_timer *next;
+	uint64_t tick;
+	int shift;
+	int level;
+	int index;
+	int count;
+
+	tick = wheel->now;
+
+	/* Cascade from the top, timers due in this very tick end up in the current slot of level 0. */
+	for (level = ZEND_FIBER_TIMER_LEVELS - 1; level > 0; level--) {
+		shift = ZEND_FIBER_TIMER_SLOT_BITS * level;
+
+		if (tick & ((((uint64_t) 1) << shift) - 1)) {
+			continue;
+		}
+
+		index = (int) ((tick >> shift) & ZEND_FIBER_TIMER_MASK);
+		timer = wheel->slots[level][index];
+
+		if (timer == NULL) {
+			continue;
+		}
+
+		wheel->slots[level][index] = NULL;
+		wheel->occupied[level] &= ~(((uint64_t) 1) << index);
+
+		for (; timer != NULL; timer = next) {
+			next = timer->next;
+
+			zend_fiber_timer_place(wheel, timer);
+		}
+	}
+
+	index = (int) (tick & ZEND_FIBER_TIMER_MASK);
+	count = 0;
+
+	while ((timer = wheel->slots[0][index]) != NULL) {
+		zend_fiber_timer_unlink(wheel, timer);
+
+		wheel->count--;
+		count++;
+
+		timer->func(timer);
+	}
+
+	return count;
+}
+
+
+uint64_t zend_fiber_timer_deadline(double seconds)
+{
+	uint64_t now;
+
+	now = zend_fiber_clock();
+
+	if (!(seconds > 0)) {
+		return now;
+	}
+
+	/* Clamped to about 100 years, the wheel re-places timers beyond its span anyway. */
+	if (seconds > 3.0e9) {
+		seconds = 3.0e9;
+	}
+
+	return now + (uint64_t) (seconds * 1.0e9);
+}
+
+
+void zend_fiber_timer_start(zend_fiber_timer *timer, uint64_t deadline, zend_fiber_timer_func func)
+{
+	zend_fiber_timer_wheel *wheel;
+
+	wheel = &FIBER_G(timers);
+
+	if (timer->slot != NULL) {
+		zend_fiber_timer_stop(timer);
+	}
+
+	/* An empty wheel can catch up with the clock without processing anything. */
+	if (wheel->count == 0) {
+		wheel->now = MAX(wheel->now, zend_fiber_clock() / ZEND_FIBER_TIMER_RESOLUTION);
+	}
+
+	timer->expires = (deadline + ZEND_FIBER_TIMER_RESOLUTION - 1) / ZEND_FIBER_TIMER_RESOLUTION;
+	timer->func = func;
+
+	/* The current tick has been processed already. */
+	if (timer->expires <= wheel->now) {
+		timer->expires = wheel->now + 1;
+	}
+
+	zend_fiber_timer_place(wheel, timer);
+
+	wheel->count++;
+}
+
+
+void zend_fiber_timer_stop(zend_fiber_timer *timer)
+{
+	zend_fiber_timer_wheel *wheel;
+
+	if (timer->slot == NULL) {
+		return;
+	}
+
+	wheel = &FIBER_G(timers);
+
+	zend_fiber_timer_unlink(wheel, timer);
+
+	wheel->count--;
+}
+
+
+zend_long zend_fiber_timer_timeout()
+{
+	zend_fiber_timer_wheel *wheel;
+	uint64_t deadline;
+	uint64_t now;
+
+	wheel = &FIBER_G(timers);
+
+	if (wheel->count == 0) {
+		return -1;
+	}
+
+	deadline = zend_fiber_timer_next(wheel) * ZEND_FIBER_TIMER_RESOLUTION;
+	now = zend_fiber_clock();
+
+	if (deadline <= now) {
+		return 0;
+	}
+
+	return (zend_long) ((deadline - now + 999999) / 1000000);
+}
+
+
+int zend_fiber_timer_advance()
+{
+	zend_fiber_timer_wheel *wheel;
+	uint64_t target;
+	uint64_t next;
+	int count;
+
+	wheel = &FIBER_G(timers);
+	target = zend_fiber_clock() / ZEND_FIBER_TIMER_RESOLUTION;
+	count = 0;
+
+	/* Jump from one non-empty slot to the next, empty ticks are never visited. */
+	while (wheel->count > 0) {
+		next = zend_fiber_timer_next(wheel);
+
+		if (next > target) {
+			break;
+		}
+
+		wheel->now = next;
+
+		count += zend_fiber_timer_process(wheel);
+	}
+
+	if (target > wheel->now) {
+		wheel->now = target;
+	}
+
+	return count;
+}
+
+
+void zend_fiber_timer_startup()
+{
+	zend_fiber_timer_wheel *wheel;
+
+	wheel = &FIBER_G(timers);
+
+	memset(wheel, 0, sizeof(zend_fiber_timer_wheel));
+
+	wheel->now = zend_fiber_clock() / ZEND_FIBER_TIMER_RESOLUTION;
+}
+
+void zend_fiber_timer_shutdown()
+{
+	zend_fiber_timer_wheel *wheel;
+	zend_fiber_timer *timer;
+	zend_fiber_timer *next;
+	int level;
+	int index;
+
+	wheel = &FIBER_G(timers);
+
+	/* Timers embedded in objects that are freed later on must not reference the wheel anymore. */
+	for (level = 0; level < ZEND_FIBER_TIMER_LEVELS; level++) {
+		for (index = 0; index < ZEND_FIBER_TIMER_SLOTS; index++) {
+			for (timer = wheel->slots[level][index]; timer != NULL; timer = next) {
+				next = timer->next;
+
+				timer->slot = NULL;
+				timer->prev = NULL;
+				timer->next = NULL;
+			}
+
+			wheel->slots[level][index] = NULL;
+		}
+
+		wheel->occupied[level] = 0;
+	}
+
+	wheel->count = 0;
+}
+
+/*
+ * vim: sw=4 ts=4
+ * vim600: fdm=marker
+ */
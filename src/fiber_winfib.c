@@ -26,11 +26,25 @@ typedef struct _zend_fiber_context_win32 {
 	zend_bool initialized;
 } zend_fiber_context_win32;
 
+/* Bytes taken by the context in front of the reserved block. */
+#define ZEND_FIBER_WIN32_CONTEXT_SIZE ZEND_MM_ALIGNED_SIZE_EX(sizeof(zend_fiber_context_win32), 64)
+
+static zend_fiber_context_win32 *zend_fiber_allocate_context(size_t reserved_size)
+{
+	zend_fiber_context_win32 *context;
+
+	/* The reserved block shares the allocation of the context. */
+	context = emalloc(ZEND_FIBER_WIN32_CONTEXT_SIZE + reserved_size);
+	ZEND_SECURE_ZERO(context, sizeof(zend_fiber_context_win32));
+
+	return context;
+}
+
 zend_fiber_context zend_fiber_create_root_context()
 {
 	zend_fiber_context_win32 *context;
 
-	context = (zend_fiber_context_win32 *) zend_fiber_create_context();
+	context = zend_fiber_allocate_context(0);
 	context->root = 1;
 	context->initialized = 1;
 
@@ -47,35 +61,25 @@ zend_fiber_context zend_fiber_create_root_context()
 	return (zend_fiber_context)context;
 }
 
-zend_fiber_context zend_fiber_create_context()
+zend_fiber_context zend_fiber_create(zend_fiber_func func, size_t stack_size, size_t reserved_size, void **reserved)
 {
 	zend_fiber_context_win32 *context;
 
-	context = emalloc(sizeof(zend_fiber_context_win32));
-	ZEND_SECURE_ZERO(context, sizeof(zend_fiber_context_win32));
-
-	return (zend_fiber_context) context;
-}
-
-zend_bool zend_fiber_create(zend_fiber_context ctx, zend_fiber_func func, size_t stack_size)
-{
-	zend_fiber_context_win32 *context;
-
-	context = (zend_fiber_context_win32 *) ctx;
-
-	if (UNEXPECTED(context->initialized == 1)) {
-		return 0;
-	}
-
+	context = zend_fiber_allocate_context(reserved_size);
 	context->fiber = CreateFiberEx(stack_size, stack_size, FIBER_FLAG_FLOAT_SWITCH, (void (*)(void *))func, context);
 
 	if (context->fiber == NULL) {
-		return 0;
+		efree(context);
+		return NULL;
+	}
+
+	if (reserved != NULL) {
+		*reserved = (reserved_size > 0) ? (void *) ((char *) context + ZEND_FIBER_WIN32_CONTEXT_SIZE) : NULL;
 	}
 
 	context->initialized = 1;
 
-	return 1;
+	return (zend_fiber_context) context;
 }
 
 void zend_fiber_destroy(zend_fiber_context ctx)
@@ -119,6 +123,29 @@ zend_bool zend_fiber_switch_context(zend_fiber_context current, zend_fiber_conte
 	return 1;
 }
 
+zend_bool zend_fiber_transfer_context(zend_fiber_context current, zend_fiber_context next)
+{
+	zend_fiber_context_win32 *from;
+	zend_fiber_context_win32 *to;
+
+	if (UNEXPECTED(current == NULL) || UNEXPECTED(next == NULL)) {
+		return 0;
+	}
+
+	from = (zend_fiber_context_win32 *) current;
+	to = (zend_fiber_context_win32 *) next;
+
+	if (UNEXPECTED(from->initialized == 0) || UNEXPECTED(to->initialized == 0)) {
+		return 0;
+	}
+
+	/* Next takes over the caller of the current fiber, suspending it returns there. */
+	to->caller = from->caller;
+	SwitchToFiber(to->fiber);
+
+	return 1;
+}
+
 zend_bool zend_fiber_suspend(zend_fiber_context current)
 {
 	zend_fiber_context_win32 *from;
@@ -138,6 +165,17 @@ zend_bool zend_fiber_suspend(zend_fiber_context current)
 	return 1;
 }
 
+size_t zend_fiber_stack_usage(zend_fiber_context ctx)
+{
+	/* Stacks created by CreateFiberEx() cannot be painted, usage is unknown. */
+	return 0;
+}
+
+void zend_fiber_reclaim(zend_fiber_context ctx)
+{
+	/* Stacks created by CreateFiberEx() are managed by the system. */
+}
+
 /*
  * vim: sw=4 ts=4
  * vim600: fdm=marker
@@ -20,6 +20,17 @@
 
 #include "php_fiber.h"
 #include "fiber.h"
+#include "fiber_scheduler.h"
+#include "fiber_channel.h"
+#include "fiber_sync.h"
+#include "fiber_cancellation.h"
+#include "fiber_local.h"
+#include "fiber_reactor.h"
+#include "fiber_io.h"
+#include "fiber_thread.h"
+#include "fiber_timer.h"
+#include "fiber_hook.h"
+#include "fiber_stack.h"
 
 ZEND_DECLARE_MODULE_GLOBALS(fiber)
 
@@ -29,6 +40,73 @@ static PHP_INI_MH(OnUpdateFiberStackSize)
 
 	if (FIBER_G(stack_size) < 0) {
 		FIBER_G(stack_size) = 0;
+	} else if (FIBER_G(stack_size) > 0 && FIBER_G(stack_size) < ZEND_FIBER_MIN_STACK_SIZE) {
+		FIBER_G(stack_size) = ZEND_FIBER_MIN_STACK_SIZE;
+	}
+
+	return SUCCESS;
+}
+
+static PHP_INI_MH(OnUpdateFiberStackPoolSize)
+{
+	OnUpdateLong(entry, new_value, mh_arg1, mh_arg2, mh_arg3, stage);
+
+	if (FIBER_G(stack_pool_size) < 0) {
+		FIBER_G(stack_pool_size) = 0;
+	}
+
+	return SUCCESS;
+}
+
+static PHP_INI_MH(OnUpdateFiberThreadPoolSize)
+{
+	OnUpdateLong(entry, new_value, mh_arg1, mh_arg2, mh_arg3, stage);
+
+	if (FIBER_G(thread_pool_size) < 0) {
+		FIBER_G(thread_pool_size) = 0;
+	} else if (FIBER_G(thread_pool_size) > 256) {
+		FIBER_G(thread_pool_size) = 256;
+	}
+
+	return SUCCESS;
+}
+
+static PHP_INI_MH(OnUpdateFiberStackReclaimThreshold)
+{
+	OnUpdateLong(entry, new_value, mh_arg1, mh_arg2, mh_arg3, stage);
+
+	/* Capped at one day, the threshold is converted to nanoseconds. */
+	if (FIBER_G(stack_reclaim_threshold) < 0) {
+		FIBER_G(stack_reclaim_threshold) = 0;
+	} else if (FIBER_G(stack_reclaim_threshold) > 86400000) {
+		FIBER_G(stack_reclaim_threshold) = 86400000;
+	}
+
+	return SUCCESS;
+}
+
+static PHP_INI_MH(OnUpdateFiberIoUringEntries)
+{
+	OnUpdateLong(entry, new_value, mh_arg1, mh_arg2, mh_arg3, stage);
+
+	/* The kernel rejects submission queues larger than 32768 entries. */
+	if (FIBER_G(io_uring_entries) < 0) {
+		FIBER_G(io_uring_entries) = 0;
+	} else if (FIBER_G(io_uring_entries) > 32768) {
+		FIBER_G(io_uring_entries) = 32768;
+	}
+
+	return SUCCESS;
+}
+
+static PHP_INI_MH(OnUpdateFiberVmStackSize)
+{
+	OnUpdateLong(entry, new_value, mh_arg1, mh_arg2, mh_arg3, stage);
+
+	if (FIBER_G(vm_stack_size) < ZEND_FIBER_VM_STACK_SIZE) {
+		FIBER_G(vm_stack_size) = ZEND_FIBER_VM_STACK_SIZE;
+	} else {
+		FIBER_G(vm_stack_size) = ZEND_MM_ALIGNED_SIZE_EX(FIBER_G(vm_stack_size), sizeof(zval));
 	}
 
 	return SUCCESS;
@@ -36,9 +114,20 @@ static PHP_INI_MH(OnUpdateFiberStackSize)
 
 PHP_INI_BEGIN()
 	STD_PHP_INI_ENTRY("fiber.stack_size", "0", PHP_INI_SYSTEM, OnUpdateFiberStackSize, stack_size, zend_fiber_globals, fiber_globals)
+	STD_PHP_INI_ENTRY("fiber.vm_stack_size", "4096", PHP_INI_SYSTEM, OnUpdateFiberVmStackSize, vm_stack_size, zend_fiber_globals, fiber_globals)
+	STD_PHP_INI_ENTRY("fiber.stack_pool_size", "16", PHP_INI_SYSTEM, OnUpdateFiberStackPoolSize, stack_pool_size, zend_fiber_globals, fiber_globals)
+	STD_PHP_INI_BOOLEAN("fiber.stack_noreserve", "0", PHP_INI_SYSTEM, OnUpdateBool, stack_noreserve, zend_fiber_globals, fiber_globals)
+	STD_PHP_INI_BOOLEAN("fiber.stack_watermark", "0", PHP_INI_SYSTEM, OnUpdateBool, stack_watermark, zend_fiber_globals, fiber_globals)
+	STD_PHP_INI_ENTRY("fiber.stack_reclaim_threshold", "0", PHP_INI_SYSTEM, OnUpdateFiberStackReclaimThreshold, stack_reclaim_threshold, zend_fiber_globals, fiber_globals)
+	STD_PHP_INI_ENTRY("fiber.io_uring_entries", "256", PHP_INI_SYSTEM, OnUpdateFiberIoUringEntries, io_uring_entries, zend_fiber_globals, fiber_globals)
+	STD_PHP_INI_BOOLEAN("fiber.profile", "0", PHP_INI_SYSTEM, OnUpdateBool, profile, zend_fiber_globals, fiber_globals)
+	STD_PHP_INI_BOOLEAN("fiber.hook_blocking", "0", PHP_INI_SYSTEM, OnUpdateBool, hook_blocking, zend_fiber_globals, fiber_globals)
+	STD_PHP_INI_ENTRY("fiber.thread_pool_size", "4", PHP_INI_SYSTEM, OnUpdateFiberThreadPoolSize, thread_pool_size, zend_fiber_globals, fiber_globals)
 PHP_INI_END()
 
 
+static zend_module_entry *zend_fiber_module;
+
 static PHP_GINIT_FUNCTION(fiber)
 {
 #if defined(ZTS) && defined(COMPILE_DL_FIBER)
@@ -50,16 +139,35 @@ static PHP_GINIT_FUNCTION(fiber)
 
 PHP_MINIT_FUNCTION(fiber)
 {
+	/* The registry holds a copy of fiber_module_entry, it is needed to keep the extension loaded on shutdown. */
+	zend_fiber_module = zend_hash_str_find_ptr(&module_registry, "fiber", sizeof("fiber") - 1);
+
 	zend_fiber_ce_register();
+	zend_fiber_scheduler_ce_register();
+	zend_fiber_reactor_ce_register();
+	zend_fiber_channel_ce_register();
+	zend_fiber_sync_ce_register();
+	zend_fiber_cancellation_ce_register();
+	zend_fiber_local_ce_register();
+	zend_fiber_thread_ce_register();
 
 	REGISTER_INI_ENTRIES();
 
+	zend_fiber_hook_startup();
+
 	return SUCCESS;
 }
 
 
 PHP_MSHUTDOWN_FUNCTION(fiber)
 {
+	zend_fiber_hook_shutdown();
+
+	/* Detached workers return into the code of the extension once their task is done, it must not be unloaded. */
+	if (!zend_fiber_thread_pool_shutdown() && zend_fiber_module != NULL) {
+		zend_fiber_module->handle = NULL;
+	}
+
 	zend_fiber_ce_unregister();
 
 	UNREGISTER_INI_ENTRIES();
@@ -68,11 +176,82 @@ PHP_MSHUTDOWN_FUNCTION(fiber)
 }
 
 
+static size_t fiber_stack_usage_percentile(int percentile)
+{
+	zend_ulong rank;
+	zend_ulong count;
+	int i;
+
+	rank = (FIBER_G(stack_usage_samples) * percentile + 99) / 100;
+	count = 0;
+
+	for (i = 0; i < ZEND_FIBER_STACK_USAGE_BUCKETS - 1; i++) {
+		count += FIBER_G(stack_usage_histogram)[i];
+
+		if (count >= rank) {
+			break;
+		}
+	}
+
+	/* Upper bound of the bucket, never report more than the actual peak. */
+	if (i + 1 >= (int) (sizeof(size_t) * 8)) {
+		return FIBER_G(stack_usage_peak);
+	}
+
+	return MIN((size_t) 1 << (i + 1), FIBER_G(stack_usage_peak));
+}
+
 static PHP_MINFO_FUNCTION(fiber)
 {
+	zend_fiber_stats *stats;
+	char buf[32];
+
+	stats = &FIBER_G(stats);
+
 	php_info_print_table_start();
 	php_info_print_table_row(2, "Fiber backend", "asm");
 	php_info_print_table_row(2, "Boost Context version", "1.67");
+	snprintf(buf, sizeof(buf), ZEND_ULONG_FMT, stats->created);
+	php_info_print_table_row(2, "Fibers created", buf);
+	snprintf(buf, sizeof(buf), ZEND_ULONG_FMT, stats->finished);
+	php_info_print_table_row(2, "Fibers finished", buf);
+	snprintf(buf, sizeof(buf), ZEND_ULONG_FMT, stats->dead);
+	php_info_print_table_row(2, "Fibers dead", buf);
+	snprintf(buf, sizeof(buf), "%u", stats->suspended);
+	php_info_print_table_row(2, "Fibers suspended", buf);
+	snprintf(buf, sizeof(buf), ZEND_ULONG_FMT, stats->create_failures);
+	php_info_print_table_row(2, "Fiber creation failures", buf);
+	snprintf(buf, sizeof(buf), ZEND_ULONG_FMT, stats->switches);
+	php_info_print_table_row(2, "Context switches", buf);
+	snprintf(buf, sizeof(buf), ZEND_ULONG_FMT, stats->vm_stack_segments_released);
+	php_info_print_table_row(2, "VM stack segments released", buf);
+	snprintf(buf, sizeof(buf), "%zu", stats->stack_mapped);
+	php_info_print_table_row(2, "Stack bytes mapped", buf);
+	snprintf(buf, sizeof(buf), ZEND_ULONG_FMT, FIBER_G(stack_pool_hits));
+	php_info_print_table_row(2, "Stack pool hits", buf);
+	snprintf(buf, sizeof(buf), ZEND_ULONG_FMT, FIBER_G(stack_pool_misses));
+	php_info_print_table_row(2, "Stack pool misses", buf);
+
+	if (FIBER_G(stack_usage_samples) > 0) {
+		snprintf(buf, sizeof(buf), ZEND_ULONG_FMT, FIBER_G(stack_usage_samples));
+		php_info_print_table_row(2, "Stack usage samples", buf);
+		snprintf(buf, sizeof(buf), "%zu", FIBER_G(stack_usage_peak));
+		php_info_print_table_row(2, "Stack usage peak", buf);
+		snprintf(buf, sizeof(buf), "%zu", fiber_stack_usage_percentile(50));
+		php_info_print_table_row(2, "Stack usage p50", buf);
+		snprintf(buf, sizeof(buf), "%zu", fiber_stack_usage_percentile(90));
+		php_info_print_table_row(2, "Stack usage p90", buf);
+		snprintf(buf, sizeof(buf), "%zu", fiber_stack_usage_percentile(99));
+		php_info_print_table_row(2, "Stack usage p99", buf);
+	}
+
+	if (FIBER_G(slice_samples) > 0) {
+		snprintf(buf, sizeof(buf), ZEND_ULONG_FMT, FIBER_G(slice_samples));
+		php_info_print_table_row(2, "Run slices", buf);
+		snprintf(buf, sizeof(buf), ZEND_ULONG_FMT, (zend_ulong) (FIBER_G(slice_peak) / 1000));
+		php_info_print_table_row(2, "Longest run slice (us)", buf);
+	}
+
 	php_info_print_table_end();
 
 	DISPLAY_INI_ENTRIES();
@@ -85,13 +264,34 @@ static PHP_RINIT_FUNCTION(fiber)
 	ZEND_TSRMLS_CACHE_UPDATE();
 #endif
 
+	zend_fiber_startup();
+	zend_fiber_scheduler_startup();
+	zend_fiber_reactor_startup();
+	zend_fiber_io_startup();
+	zend_fiber_tasks_startup();
+	zend_fiber_timer_startup();
+	zend_fiber_local_startup();
+
+#ifndef PHP_WIN32
+	zend_fiber_stack_pool_init();
+#endif
+
 	return SUCCESS;
 }
 
 static PHP_RSHUTDOWN_FUNCTION(fiber)
 {
+	zend_fiber_io_shutdown();
+	zend_fiber_tasks_shutdown();
+	zend_fiber_reactor_shutdown();
+	zend_fiber_timer_shutdown();
+	zend_fiber_local_shutdown();
 	zend_fiber_shutdown();
 
+#ifndef PHP_WIN32
+	zend_fiber_stack_pool_shutdown();
+#endif
+
 	return SUCCESS;
 }
 
@@ -10,14 +10,72 @@ final class Fiber
 
     /**
      * @param callable $callback Function to invoke when starting the Fiber.
+     * @param int $stackSize Size of the C stack in bytes, 0 to use the fiber.stack_size INI setting.
+     *
+     * @throws Error If the stack size is below the minimum supported stack size.
      */
-    public function __construct(callable $callback) { }
+    public function __construct(callable $callback, int $stackSize = 0) { }
 
     /**
      * @return int One of the Fiber status constants.
      */
     public function status(): int { }
 
+    public function isRunning(): bool { }
+
+    public function isSuspended(): bool { }
+
+    /**
+     * @return bool True if the fiber has returned, thrown or been destroyed.
+     */
+    public function isTerminated(): bool { }
+
+    /**
+     * @return mixed Value returned by the fiber callback.
+     *
+     * @throws Error If the fiber has not returned.
+     */
+    public function getReturn() { }
+
+    /**
+     * @return Fiber|null The running fiber, null if not within a Fiber context.
+     */
+    public static function getCurrent(): ?Fiber { }
+
+    /**
+     * Requires fiber.stack_watermark to be enabled, the stack is painted when the fiber is started and scanned for
+     * the deepest word that has been overwritten.
+     *
+     * @return int|null Peak number of C stack bytes used by the fiber, null if the usage has not been measured.
+     */
+    public function getStackUsage(): ?int { }
+
+    /**
+     * Returns counters of the fiber runtime. They are kept per thread (per process without ZTS) and are not reset
+     * between requests, except for the current values suspended and stack_mapped.
+     *
+     * @return int[] Keys created, finished, dead, suspended, switches, stack_mapped (bytes of C stacks currently
+     *     mapped), stacks_reused, stacks_allocated, vm_stack_segments_released (extra VM stack segments freed when
+     *     fibers ended) and create_failures.
+     */
+    public static function getStats(): array { }
+
+    /**
+     * Requires fiber.profile to be enabled. A run slice lasts from switching into the fiber until it suspends or
+     * starts or resumes another fiber, time spent in other fibers is not included.
+     *
+     * @return array|null Keys run_time (seconds the fiber has been running), slices (number of run slices) and
+     *     slice_max (seconds of the longest slice), null if profiling is disabled.
+     */
+    public function getProfile(): ?array { }
+
+    /**
+     * @return int[] Number of run slices of all fibers keyed by bucket n, which counts slices shorter than
+     *     2^(n + 1) microseconds. The last bucket (31) also counts all longer slices, empty buckets are left out.
+     *     Requires fiber.profile to be enabled.
+     */
+    public static function getSliceHistogram(): array { }
+
     /**
      * Start the Fiber by invoking the callback given to the constructor with the given arguments.
      *
@@ -40,6 +98,21 @@ final class Fiber
      */
     public function resume($value = null) { }
 
+    /**
+     * Starts or resumes each of the fibers in turn, equivalent to calling {@see Fiber::start()} or
+     * {@see Fiber::resume()} on each one without the overhead of a method call per fiber.
+     *
+     * @param Fiber[] $fibers
+     * @param array $values Values passed to the fibers, a fiber receives the value with the same key (if any). It is
+     *     the only argument of a fiber that has not been started.
+     *
+     * @return array Values the fibers suspended with or returned, keyed like the fibers.
+     *
+     * @throws Error If an element is not a fiber or a fiber is running or has terminated.
+     * @throws Throwable If a fiber throws, remaining fibers are not resumed.
+     */
+    public static function resumeAll(array $fibers, array $values = []): array { }
+
     /**
      * @param Throwable $exception Exception to throw from {@see Fiber::suspend()}.
      *
@@ -58,4 +131,339 @@ final class Fiber
      * @throws Error Thrown if not within a Fiber context.
      */
     public static function suspend($value = null) { }
+
+    /**
+     * Puts the current fiber at the end of the scheduler run queue and switches to the next runnable fiber. Returns
+     * immediately if no other fiber is runnable.
+     *
+     * @throws Error Thrown if not within a Fiber context.
+     */
+    public static function yield(): void { }
+
+    /**
+     * Suspends the current fiber until the given fiber has terminated, other runnable fibers are run in the meantime.
+     *
+     * @param Fiber $fiber
+     *
+     * @return mixed Return value of the awaited fiber.
+     *
+     * @throws Error Thrown if not within a Fiber context or if the awaited fiber threw an exception.
+     */
+    public static function await(Fiber $fiber) { }
+
+    /**
+     * Suspends the current fiber and switches directly to the given fiber without returning to the caller first. The
+     * given fiber is started with the value as argument if it has not been started, otherwise the value is returned
+     * from its {@see Fiber::suspend()} call. Values it suspends with are returned to the caller of the current fiber.
+     *
+     * @param Fiber $next
+     * @param mixed $value
+     *
+     * @return mixed Value given to {@see Fiber::resume()} or {@see Fiber::transfer()} when resuming the fiber.
+     *
+     * @throws Error Thrown if not within a Fiber context or if the given fiber is running or has terminated.
+     */
+    public static function transfer(Fiber $next, $value = null) { }
+
+    /**
+     * Cancels the fiber along with all fibers started or scheduled by it after it became cancellable (by calling this
+     * method or {@see Fiber::cancelAfter()}). A cancelled fiber waiting for I/O, a timer, a channel or another fiber
+     * is scheduled right away and a FiberCancelledError is thrown from the wait, as it is from any later wait.
+     */
+    public function cancel(): void { }
+
+    /**
+     * Cancels the fiber like {@see Fiber::cancel()} once the given number of seconds has passed.
+     *
+     * @param float $seconds
+     */
+    public function cancelAfter(float $seconds): void { }
+
+    public function isCancelled(): bool { }
+
+    /**
+     * Suspends the current fiber for the given number of seconds, other runnable fibers are run in the meantime.
+     * Timers are kept in a hierarchical timer wheel with a resolution of 1 millisecond and expire in
+     * {@see FiberScheduler::run()}.
+     *
+     * @param float $seconds
+     *
+     * @throws Error Thrown if not within a Fiber context.
+     */
+    public static function sleep(float $seconds): void { }
+}
+
+final class FiberCancelledError extends Error
+{
+}
+
+final class FiberScheduler
+{
+    /**
+     * Appends a fiber to the run queue. Fibers that have not been started are started with the value as argument,
+     * suspended fibers are resumed with the value.
+     *
+     * @param Fiber $fiber
+     * @param mixed $value
+     *
+     * @throws Error If the fiber is running, has terminated or is already queued.
+     */
+    public static function schedule(Fiber $fiber, $value = null): void { }
+
+    /**
+     * Runs fibers from the run queue until it is empty.
+     *
+     * If fiber.hook_blocking is enabled, blocking reads, writes, connects and accepts on tcp, udp and unix socket
+     * streams as well as sleep() and usleep() suspend the calling fiber while it is run by the scheduler.
+     *
+     * @throws Throwable If a scheduled fiber throws, the exception will be thrown from this call.
+     */
+    public static function run(): void { }
+}
+
+final class FiberIO
+{
+    public const READABLE = 1;
+    public const WRITABLE = 2;
+
+    /**
+     * Suspends the current fiber until the stream or file descriptor becomes readable or writable. Readiness is
+     * detected by {@see FiberScheduler::run()}, which resumes the fiber through its run queue.
+     *
+     * @param resource|int $stream Stream resource or file descriptor.
+     * @param int $events Bitmask of FiberIO::READABLE and FiberIO::WRITABLE.
+     * @param float|null $timeout Max number of seconds to wait, null to wait without a deadline.
+     *
+     * @return int Bitmask of the events that occurred, 0 if the timeout has expired.
+     *
+     * @throws Error Thrown if not within a Fiber context or if the stream has no file descriptor.
+     */
+    public static function poll($stream, int $events, ?float $timeout = null): int { }
+
+    /**
+     * Reads up to $length bytes, suspending the current fiber until data is available. Operations of all fibers are
+     * submitted to io_uring in one batch per scheduler tick if it is available (see fiber.io_uring_entries),
+     * otherwise the fiber waits for readiness like {@see FiberIO::poll()}. The position of the stream is not updated.
+     *
+     * @param resource|int $stream Stream resource or file descriptor.
+     * @param int $length Max number of bytes to read.
+     * @param int|null $offset Offset to read from, null to read from the current file position.
+     *
+     * @return string Data read, an empty string on end of file.
+     *
+     * @throws Error Thrown if not within a Fiber context or if reading fails.
+     */
+    public static function read($stream, int $length, ?int $offset = null): string { }
+
+    /**
+     * Writes data, suspending the current fiber until at least part of it has been written.
+     *
+     * @param resource|int $stream Stream resource or file descriptor.
+     * @param string $data
+     * @param int|null $offset Offset to write at, null to write at the current file position.
+     *
+     * @return int Number of bytes written.
+     *
+     * @throws Error Thrown if not within a Fiber context or if writing fails.
+     */
+    public static function write($stream, string $data, ?int $offset = null): int { }
+
+    /**
+     * Flushes written data to the storage device, suspending the current fiber until it is done.
+     *
+     * @param resource|int $stream Stream resource or file descriptor.
+     *
+     * @throws Error Thrown if not within a Fiber context or if syncing fails.
+     */
+    public static function fsync($stream): void { }
+}
+
+final class FiberChannel
+{
+    /**
+     * @param int $capacity Number of values buffered by the channel, 0 for an unbuffered channel that hands every
+     *     value directly from sender to receiver.
+     *
+     * @throws Error If the capacity is negative.
+     */
+    public function __construct(int $capacity = 0) { }
+
+    /**
+     * Sends a value, suspending the current fiber while the buffer is full. A waiting receiver is scheduled with the
+     * value right away.
+     *
+     * @param mixed $value
+     *
+     * @throws Error If the channel is closed, or it is full and not called within a fiber.
+     */
+    public function send($value): void { }
+
+    /**
+     * Receives the next value, suspending the current fiber while the channel is empty.
+     *
+     * @return mixed Received value, null once the channel has been closed and all buffered values have been received.
+     *
+     * @throws Error If the channel is empty and not called within a fiber.
+     */
+    public function receive() { }
+
+    /**
+     * Closes the channel, buffered values can still be received. Fibers waiting to receive are resumed with null,
+     * fibers waiting to send get an Error thrown.
+     */
+    public function close(): void { }
+
+    public function isClosed(): bool { }
+
+    /**
+     * @return int Number of buffered values.
+     */
+    public function count(): int { }
+
+    public function getCapacity(): int { }
+}
+
+/**
+ * Fibers blocked in lock() acquire the mutex in FIFO order, unlock() hands it to the next one directly.
+ */
+final class FiberMutex
+{
+    /**
+     * Locks the mutex, suspending the current fiber while it is held by another fiber.
+     *
+     * @throws Error If the mutex is already held by the current fiber, or it is locked and not called within a fiber.
+     */
+    public function lock(): void { }
+
+    public function tryLock(): bool { }
+
+    /**
+     * @throws Error If the mutex is not locked by the current fiber.
+     */
+    public function unlock(): void { }
+
+    public function isLocked(): bool { }
+}
+
+final class FiberSemaphore
+{
+    /**
+     * @param int $permits Number of permits initially available.
+     */
+    public function __construct(int $permits) { }
+
+    /**
+     * Takes a permit, suspending the current fiber until one is released if none is available. Waiting fibers are
+     * granted released permits in FIFO order.
+     *
+     * @throws Error If no permit is available and not called within a fiber.
+     */
+    public function acquire(): void { }
+
+    public function tryAcquire(): bool { }
+
+    /**
+     * @throws Error If the number of available permits would exceed PHP_INT_MAX.
+     */
+    public function release(): void { }
+
+    public function getAvailable(): int { }
+}
+
+final class FiberWaitGroup
+{
+    /**
+     * Adds to the number of pending tasks, all waiting fibers are resumed once it drops to 0.
+     *
+     * @throws Error If the counter would become negative.
+     */
+    public function add(int $delta = 1): void { }
+
+    public function done(): void { }
+
+    /**
+     * Suspends the current fiber until the number of pending tasks is 0.
+     *
+     * @throws Error If tasks are pending and not called within a fiber.
+     */
+    public function wait(): void { }
+
+    public function count(): int { }
+}
+
+/**
+ * Storage for values that are local to a fiber, like a request id or a tracing span. Values set outside of a fiber
+ * belong to the main context.
+ */
+final class FiberLocal
+{
+    /**
+     * Reserves a new storage slot, slots are valid for the rest of the request.
+     *
+     * @param bool $inherit Whether fibers copy the value of the slot from the fiber (or main context) starting or
+     *     scheduling them, unless a value has been set on them before.
+     *
+     * @return int Slot number to be passed to {@see FiberLocal::get()} and {@see FiberLocal::set()}.
+     */
+    public static function register(bool $inherit = false): int { }
+
+    /**
+     * @param int $slot
+     *
+     * @return mixed Value of the slot in the current fiber, null if it has not been set.
+     *
+     * @throws Error If the slot has not been registered.
+     */
+    public static function get(int $slot) { }
+
+    /**
+     * @param int $slot
+     * @param mixed $value
+     *
+     * @throws Error If the slot has not been registered.
+     */
+    public static function set(int $slot, $value): void { }
+}
+
+/**
+ * Runs blocking calls in native worker threads (see fiber.thread_pool_size) while the current fiber is suspended,
+ * other fibers keep running meanwhile. The calls run inline if no worker threads are available.
+ */
+final class FiberThreadPool
+{
+    /**
+     * Resolves a hostname using getaddrinfo().
+     *
+     * @param string $hostname
+     *
+     * @return string[] IPv4 and IPv6 addresses of the host.
+     *
+     * @throws Error Thrown if not within a Fiber context or if the hostname cannot be resolved.
+     */
+    public static function resolve(string $hostname): array { }
+
+    /**
+     * Relative paths are resolved against the current working directory, open_basedir applies.
+     *
+     * @param string $path
+     *
+     * @return int[] Keys dev, ino, mode, nlink, uid, gid, rdev, size, atime, mtime and ctime like stat().
+     *
+     * @throws Error Thrown if not within a Fiber context, if the path is outside open_basedir or if the file
+     *     cannot be accessed.
+     */
+    public static function stat(string $path): array { }
+
+    /**
+     * Reads the whole file, stream wrappers are not supported. Relative paths are resolved against the current
+     * working directory, open_basedir applies.
+     *
+     * @param string $path
+     *
+     * @return string
+     *
+     * @throws Error Thrown if not within a Fiber context, if the path is outside open_basedir or if the file
+     *     cannot be read.
+     */
+    public static function readFile(string $path): string { }
 }
@@ -0,0 +1,37 @@
+--TEST--
+Fibers started before their parent is cancelled are cancelled along with it
+--SKIPIF--
+<?php if (!extension_loaded('fiber')) die('skip fiber extension not loaded'); ?>
+--FILE--
+<?php
+
+$parent = new Fiber(function (): void {
+    $child = new Fiber(function (): void {
+        try {
+            Fiber::sleep(1);
+            echo "not cancelled\n";
+        } catch (FiberCancelledError $e) {
+            echo $e->getMessage(), "\n";
+        }
+    });
+
+    $child->start();
+
+    Fiber::suspend();
+});
+
+$parent->start();
+
+var_dump($parent->isCancelled());
+
+$parent->cancel();
+
+var_dump($parent->isCancelled());
+
+FiberScheduler::run();
+
+?>
+--EXPECT--
+bool(false)
+bool(true)
+Fiber has been cancelled
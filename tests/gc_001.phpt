@@ -0,0 +1,47 @@
+--TEST--
+Suspended fiber running a method callback survives the cycle collector
+--SKIPIF--
+<?php if (!extension_loaded('fiber')) die('skip fiber extension not loaded'); ?>
+--FILE--
+<?php
+
+class Task
+{
+    public $fiber;
+    public $data = [1, 2, 3];
+
+    public function run(): int
+    {
+        return array_sum($this->data) + Fiber::suspend();
+    }
+}
+
+$task = new Task;
+$task->fiber = new Fiber([$task, 'run']);
+$task->fiber->start();
+
+gc_collect_cycles();
+
+var_dump($task->fiber->resume(4));
+
+function consume(array $values, int $value): int
+{
+    return count($values) + $value;
+}
+
+$fiber = new Fiber(function (): int {
+    $object = new stdClass;
+
+    return consume([$object, $object], Fiber::suspend());
+});
+
+$fiber->start();
+
+gc_collect_cycles();
+
+var_dump($fiber->resume(1));
+
+?>
+--EXPECT--
+int(10)
+int(3)
@@ -0,0 +1,32 @@
+--TEST--
+Suspended fiber only reachable through a cycle is collected and unwound
+--SKIPIF--
+<?php if (!extension_loaded('fiber')) die('skip fiber extension not loaded'); ?>
+--FILE--
+<?php
+
+class Holder
+{
+    public $fiber;
+}
+
+$holder = new Holder;
+$holder->fiber = new Fiber(function () use ($holder): void {
+    try {
+        Fiber::suspend();
+        echo "resumed\n";
+    } finally {
+        echo "unwound\n";
+    }
+});
+
+$holder->fiber->start();
+
+unset($holder);
+
+var_dump(gc_collect_cycles() > 0);
+
+?>
+--EXPECT--
+unwound
+bool(true)
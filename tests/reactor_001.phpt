@@ -0,0 +1,34 @@
+--TEST--
+Deadline expiring in the same tick does not discard the readiness of a socket
+--SKIPIF--
+<?php
+if (!extension_loaded('fiber')) die('skip fiber extension not loaded');
+if (PHP_OS_FAMILY === 'Windows') die('skip unix sockets required');
+?>
+--INI--
+fiber.hook_blocking=0
+--FILE--
+<?php
+
+[$a, $b] = stream_socket_pair(STREAM_PF_UNIX, STREAM_SOCK_STREAM, STREAM_IPPROTO_IP);
+
+$reader = new Fiber(function () use ($a): void {
+    var_dump(FiberIO::poll($a, FiberIO::READABLE, 0.05) === FiberIO::READABLE);
+    var_dump(fread($a, 1));
+});
+
+$writer = new Fiber(function () use ($b): void {
+    fwrite($b, "x");
+
+    /* Blocks the thread until the deadline of the reader has passed as well. */
+    usleep(100000);
+});
+
+FiberScheduler::schedule($reader);
+FiberScheduler::schedule($writer);
+FiberScheduler::run();
+
+?>
+--EXPECT--
+bool(true)
+string(1) "x"
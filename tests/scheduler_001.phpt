@@ -0,0 +1,51 @@
+--TEST--
+Fibers parked on a channel or mutex that nothing else references are collected
+--SKIPIF--
+<?php if (!extension_loaded('fiber')) die('skip fiber extension not loaded'); ?>
+--FILE--
+<?php
+
+$channel = new FiberChannel();
+$receiver = new Fiber(function () use ($channel): void {
+    try {
+        $channel->receive();
+    } finally {
+        echo "receiver unwound\n";
+    }
+});
+
+$mutex = new FiberMutex();
+$mutex->lock();
+$locker = new Fiber(function () use ($mutex): void {
+    try {
+        $mutex->lock();
+    } finally {
+        echo "locker unwound\n";
+    }
+});
+
+FiberScheduler::schedule($receiver);
+FiberScheduler::schedule($locker);
+FiberScheduler::run();
+
+var_dump($receiver->isSuspended(), $locker->isSuspended());
+
+unset($receiver, $channel);
+
+var_dump(gc_collect_cycles() > 0);
+
+unset($locker, $mutex);
+
+var_dump(gc_collect_cycles() > 0);
+
+echo "end\n";
+
+?>
+--EXPECT--
+bool(true)
+bool(true)
+receiver unwound
+bool(true)
+locker unwound
+bool(true)
+end
@@ -0,0 +1,29 @@
+--TEST--
+Scheduled fiber suspending itself is only kept alive by its references
+--SKIPIF--
+<?php if (!extension_loaded('fiber')) die('skip fiber extension not loaded'); ?>
+--FILE--
+<?php
+
+$fiber = new Fiber(function (): void {
+    try {
+        Fiber::suspend();
+    } finally {
+        echo "unwound\n";
+    }
+});
+
+FiberScheduler::schedule($fiber);
+FiberScheduler::run();
+
+echo "unset\n";
+
+unset($fiber);
+
+echo "end\n";
+
+?>
+--EXPECT--
+unset
+unwound
+end
@@ -0,0 +1,37 @@
+--TEST--
+Fiber stack size given to the constructor is validated
+--SKIPIF--
+<?php if (!extension_loaded('fiber')) die('skip fiber extension not loaded'); ?>
+--FILE--
+<?php
+
+foreach ([1, -4096] as $size) {
+    try {
+        new Fiber(function () { }, $size);
+    } catch (Error $e) {
+        echo $e->getMessage(), "\n";
+    }
+}
+
+$fiber = new Fiber(function (int $x) {
+    return Fiber::suspend($x) * 2;
+}, 1024 * 1024);
+
+var_dump($fiber->start(21));
+$fiber->resume(21);
+var_dump($fiber->getReturn());
+
+$fiber = new Fiber(function () {
+    return 'default';
+}, 0);
+
+$fiber->start();
+var_dump($fiber->getReturn());
+
+?>
+--EXPECTF--
+Fiber stack size must be at least %d bytes
+Fiber stack size must be at least %d bytes
+int(21)
+int(42)
+string(7) "default"
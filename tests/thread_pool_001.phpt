@@ -0,0 +1,39 @@
+--TEST--
+FiberThreadPool::readFile() and stat() resolve relative paths and honor open_basedir
+--SKIPIF--
+<?php if (!extension_loaded('fiber')) die('skip fiber extension not loaded'); ?>
+--INI--
+fiber.thread_pool_size=2
+--FILE--
+<?php
+
+chdir(__DIR__);
+
+$fiber = new Fiber(function (): void {
+    var_dump(FiberThreadPool::readFile(basename(__FILE__)) === file_get_contents(__FILE__));
+    var_dump(FiberThreadPool::stat(basename(__FILE__))['size'] === filesize(__FILE__));
+
+    ini_set('open_basedir', __DIR__);
+
+    try {
+        FiberThreadPool::stat(dirname(__DIR__));
+    } catch (Error $e) {
+        echo $e->getMessage(), "\n";
+    }
+
+    try {
+        FiberThreadPool::readFile(basename(__FILE__) . '.missing');
+    } catch (Error $e) {
+        echo "missing\n";
+    }
+});
+
+FiberScheduler::schedule($fiber);
+FiberScheduler::run();
+
+?>
+--EXPECTF--
+bool(true)
+bool(true)
+open_basedir restriction in effect, %s is not within the allowed path(s)
+missing
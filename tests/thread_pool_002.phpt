@@ -0,0 +1,64 @@
+--TEST--
+Fibers resumed before their task completed and tasks still in flight at the end of the request
+--SKIPIF--
+<?php
+if (!extension_loaded('fiber')) die('skip fiber extension not loaded');
+if (!function_exists('posix_mkfifo')) die('skip posix_mkfifo() required');
+?>
+--INI--
+fiber.thread_pool_size=2
+--FILE--
+<?php
+
+$early = __DIR__ . '/thread_pool_002.early.fifo';
+$abandoned = __DIR__ . '/thread_pool_002.abandoned.fifo';
+
+posix_mkfifo($early, 0600);
+posix_mkfifo($abandoned, 0600);
+
+/* Opening a FIFO blocks the worker until a writer shows up. */
+$reader = new Fiber(function () use ($early): void {
+    try {
+        FiberThreadPool::readFile($early);
+        echo "not cancelled\n";
+    } catch (FiberCancelledError $e) {
+        echo $e->getMessage(), "\n";
+    }
+});
+
+$reader->start();
+$reader->cancel();
+
+$writer = fopen($early, 'w');
+fwrite($writer, 'data');
+fclose($writer);
+
+/* Returns once the orphaned task has been reaped. */
+FiberScheduler::run();
+
+echo "reaped\n";
+
+/* Never completes, the request must end without waiting for it. */
+$blocked = new Fiber(function () use ($abandoned): void {
+    try {
+        FiberThreadPool::readFile($abandoned);
+    } finally {
+        echo "unwound\n";
+    }
+});
+
+$blocked->start();
+
+echo "done\n";
+
+?>
+--CLEAN--
+<?php
+@unlink(__DIR__ . '/thread_pool_002.early.fifo');
+@unlink(__DIR__ . '/thread_pool_002.abandoned.fifo');
+?>
+--EXPECT--
+Fiber has been cancelled
+reaped
+done
+unwound
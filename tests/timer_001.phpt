@@ -0,0 +1,30 @@
+--TEST--
+FiberIO::poll() returns 0 once its timeout has expired
+--SKIPIF--
+<?php
+if (!extension_loaded('fiber')) die('skip fiber extension not loaded');
+if (PHP_OS_FAMILY === 'Windows') die('skip unix sockets required');
+?>
+--FILE--
+<?php
+
+[$a, $b] = stream_socket_pair(STREAM_PF_UNIX, STREAM_SOCK_STREAM, STREAM_IPPROTO_IP);
+
+$fiber = new Fiber(function () use ($a): void {
+    $start = microtime(true);
+
+    var_dump(FiberIO::poll($a, FiberIO::READABLE, 0.02));
+    var_dump(microtime(true) - $start >= 0.015);
+
+    Fiber::sleep(0.01);
+    echo "slept\n";
+});
+
+FiberScheduler::schedule($fiber);
+FiberScheduler::run();
+
+?>
+--EXPECT--
+int(0)
+bool(true)
+slept
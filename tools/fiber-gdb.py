@@ -0,0 +1,167 @@
+# gdb helpers for ext-fiber, load with "source tools/fiber-gdb.py" while debugging a php binary (NTS builds).
+#
+#   php-fibers             Lists all fiber objects with their handle and status.
+#   php-fiber-bt <handle>  Prints the PHP and the C backtrace of a suspended fiber.
+#
+# The C backtrace of a suspended fiber is taken by temporarily loading the registers saved by jump_fcontext
+# (x86_64 only), so the process must be live, core files cannot be walked this way.
+
+import gdb
+
+STATUS = {0: "init", 1: "suspended", 2: "running", 3: "finished", 4: "dead"}
+
+# Layout of the context-data saved by jump_fcontext on x86_64, see boost/asm/jump_x86_64_sysv_elf_gas.S.
+CONTEXT_REGISTERS = (("r12", 0x8), ("r13", 0x10), ("r14", 0x18), ("r15", 0x20), ("rbx", 0x28), ("rbp", 0x30))
+CONTEXT_RIP = 0x38
+CONTEXT_SIZE = 0x40
+
+
+def zstr(value):
+    if int(value) == 0:
+        return ""
+
+    return value["val"].address.cast(gdb.lookup_type("char").pointer()).string(length=int(value["len"]))
+
+
+def fibers():
+    try:
+        store = gdb.parse_and_eval("executor_globals.objects_store")
+    except gdb.error:
+        raise gdb.GdbError("executor_globals not found, ZTS builds are not supported")
+
+    fiber_type = gdb.lookup_type("zend_fiber").pointer()
+
+    for handle in range(1, int(store["top"])):
+        bucket = store["object_buckets"][handle]
+
+        # Free slots are tagged in the lowest bit.
+        if int(bucket) == 0 or int(bucket) & 1:
+            continue
+
+        if zstr(bucket["ce"]["name"]) == "Fiber":
+            yield handle, bucket.cast(fiber_type)
+
+
+def find_fiber(handle):
+    for current, fiber in fibers():
+        if current == handle:
+            return fiber
+
+    raise gdb.GdbError("No fiber with handle %d" % handle)
+
+
+def php_backtrace(fiber):
+    # Bottom frame of every fiber, it runs the callable and catches uncaught exceptions.
+    try:
+        run_func = int(gdb.parse_and_eval("&fiber_run_func"))
+    except gdb.error:
+        run_func = 0
+
+    ex = fiber["exec"]
+    depth = 0
+
+    while int(ex) != 0:
+        func = ex["func"]
+
+        # Dummy frames pushed for internal calls have no function.
+        if int(func) == 0:
+            ex = ex["prev_execute_data"]
+            continue
+
+        name = zstr(func["common"]["function_name"]) or "{main}"
+
+        # Without symbols of the static fiber_run_func it is recognized by its name, it has no scope.
+        if int(func) == run_func or (run_func == 0 and name == "Fiber::run" and int(func["common"]["scope"]) == 0):
+            gdb.write("#%-3d {fiber}\n" % depth)
+            break
+        scope = func["common"]["scope"]
+
+        if int(scope) != 0:
+            name = zstr(scope["name"]) + "::" + name
+
+        # ZEND_USER_FUNCTION
+        if int(func["type"]) == 2 and int(ex["opline"]) != 0:
+            location = "%s:%d" % (zstr(func["op_array"]["filename"]), int(ex["opline"]["lineno"]))
+        else:
+            location = "[internal]"
+
+        gdb.write("#%-3d %s() %s\n" % (depth, name, location))
+
+        ex = ex["prev_execute_data"]
+        depth += 1
+
+
+def c_backtrace(fiber):
+    if gdb.lookup_type("long").sizeof != 8 or "x86-64" not in gdb.selected_frame().architecture().name():
+        gdb.write("C backtraces of suspended fibers are only supported on x86_64\n")
+        return
+
+    ulong = gdb.lookup_type("unsigned long").pointer()
+
+    # The fcontext_t saved on suspension is the first member of the native context.
+    ctx = int(fiber["context"].cast(ulong).dereference())
+
+    def load(offset):
+        return int(gdb.Value(ctx + offset).cast(ulong).dereference())
+
+    saved = {}
+
+    for register in ("rsp", "rip") + tuple(name for name, _ in CONTEXT_REGISTERS):
+        saved[register] = int(gdb.parse_and_eval("$" + register))
+
+    gdb.execute("select-frame 0", to_string=True)
+
+    try:
+        for name, offset in CONTEXT_REGISTERS:
+            gdb.execute("set $%s = %d" % (name, load(offset)))
+
+        gdb.execute("set $rip = %d" % load(CONTEXT_RIP))
+        gdb.execute("set $rsp = %d" % (ctx + CONTEXT_SIZE))
+        gdb.execute("backtrace")
+    finally:
+        for register, value in saved.items():
+            gdb.execute("set $%s = %d" % (register, value))
+
+
+class FibersCommand(gdb.Command):
+    """Lists all fiber objects: php-fibers"""
+
+    def __init__(self):
+        super(FibersCommand, self).__init__("php-fibers", gdb.COMMAND_STACK)
+
+    def invoke(self, arg, from_tty):
+        current = int(gdb.parse_and_eval("fiber_globals.current_fiber"))
+
+        for handle, fiber in fibers():
+            status = STATUS.get(int(fiber["status"]), "unknown")
+
+            if int(fiber) == current:
+                status += ", current"
+
+            gdb.write("%-6d %s (%s)\n" % (handle, str(fiber), status))
+
+
+class FiberBacktraceCommand(gdb.Command):
+    """Prints the PHP and C backtrace of a suspended fiber: php-fiber-bt <handle>"""
+
+    def __init__(self):
+        super(FiberBacktraceCommand, self).__init__("php-fiber-bt", gdb.COMMAND_STACK)
+
+    def invoke(self, arg, from_tty):
+        if not arg:
+            raise gdb.GdbError("Usage: php-fiber-bt <handle>")
+
+        fiber = find_fiber(int(gdb.parse_and_eval(arg)))
+
+        if int(fiber["status"]) != 1:
+            raise gdb.GdbError("Fiber is %s, only suspended fibers can be walked" % STATUS.get(int(fiber["status"]), "unknown"))
+
+        gdb.write("PHP backtrace:\n")
+        php_backtrace(fiber)
+
+        gdb.write("\nC backtrace:\n")
+        c_backtrace(fiber)
+
+
+FibersCommand()
+FiberBacktraceCommand()